@@ -0,0 +1,56 @@
+# Measure the time taken by package require tkgst.
+#
+# Each sample loads the package into a fresh wish process so that nothing is
+# cached between runs. Pass more than one build directory to compare builds,
+# for instance before and after a change:
+#
+#   tclsh bench.tcl ?-samples n? build ?build ...?
+#
+
+package require Tcl 8.6
+
+proc Sample {wish build} {
+    set script [format {
+        set auto_path [linsert $auto_path 0 %s]
+        wm withdraw .
+        set t [clock microseconds]
+        package require tkgst
+        puts [expr {[clock microseconds] - $t}]
+        exit
+    } [list $build]]
+    set f [file tempfile tmpname]
+    puts $f $script
+    close $f
+    set usec [exec {*}$wish $tmpname]
+    file delete $tmpname
+    return $usec
+}
+
+proc Main {args} {
+    set samples 20
+    if {[lindex $args 0] eq "-samples"} {
+        set samples [lindex $args 1]
+        set args [lrange $args 2 end]
+    }
+    if {[llength $args] < 1} {
+        puts stderr "usage: tclsh bench.tcl ?-samples n? build ?build ...?"
+        exit 1
+    }
+    set wish [auto_execok wish]
+
+    foreach build $args {
+        set build [file normalize $build]
+        set times {}
+        for {set n 0} {$n < $samples} {incr n} {
+            lappend times [Sample $wish $build]
+        }
+        set times [lsort -integer $times]
+        set mean [expr {[tcl::mathop::+ {*}$times] / double($samples)}]
+        puts [format "%-40s min %8.3f ms  median %8.3f ms  mean %8.3f ms" $build \
+            [expr {[lindex $times 0] / 1000.0}] \
+            [expr {[lindex $times [expr {$samples / 2}]] / 1000.0}] \
+            [expr {$mean / 1000.0}]]
+    }
+}
+
+Main {*}$argv
@@ -0,0 +1,78 @@
+# Check the audio branch against audiotestsrc.
+#
+# Needs an X display with Xv but no camera or sound card. Plays a widget
+# with -audiodevice audiotestsrc and checks the rate and shape of the
+# -levelcommand calls, that $w stats reports the A/V drift and that the
+# calls stop while the widget is paused. Exits with a non-zero status if
+# any check fails.
+#
+#   wish levels.tcl ?build?
+#
+
+package require Tcl 8.6
+package require Tk 8.6
+
+set build [lindex $argv 0]
+if {$build eq ""} {
+    set build [file join [file dirname [info script]] build]
+}
+set auto_path [linsert $auto_path 0 [file normalize $build]]
+package require tkgst
+
+set failures 0
+set calls {}
+
+proc Check {name ok detail} {
+    global failures
+    if {[uplevel 1 [list expr $ok]]} {
+        puts "ok   $name"
+    } else {
+        puts "FAIL $name: $detail"
+        incr failures
+    }
+}
+
+proc Wait {ms} {
+    after $ms [list set ::waited 1]
+    vwait ::waited
+}
+
+proc OnLevel {peaks rms} {
+    lappend ::calls [list [clock milliseconds] $peaks $rms]
+}
+
+gst .v -device videotestsrc -audiodevice audiotestsrc -width 320 -height 240 \
+    -levelcommand OnLevel
+pack .v
+update
+.v play
+Wait 1000
+
+# Measure the delivery rate once the pipeline is running.
+set calls {}
+Wait 2000
+set count [llength $calls]
+set rate [expr {$count / 2.0}]
+Check "level rate" {$rate >= 25 && $rate <= 35} "$rate calls per second"
+
+# audiotestsrc fixates to mono so each call carries one reading per list.
+set shapes [lsort -unique [lmap call $calls {
+    list [llength [lindex $call 1]] [llength [lindex $call 2]]
+}]]
+Check "level channels" {$shapes eq {{1 1}}} $shapes
+set readings [concat {*}[lmap call $calls {concat [lindex $call 1] [lindex $call 2]}]]
+Check "level range" {$count > 0 && [tcl::mathfunc::max {*}$readings] <= 0.0} \
+    [lrange $readings 0 9]
+
+set stats [.v stats]
+Check "avdrift present" {[dict exists $stats avdrift]} $stats
+
+# A paused widget must not be called back.
+.v pause
+Wait 200
+set calls {}
+Wait 500
+Check "paused silent" {[llength $calls] == 0} "[llength $calls] calls"
+
+destroy .v
+exit [expr {$failures != 0}]
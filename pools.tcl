@@ -0,0 +1,81 @@
+# Check the buffer pool options against videotestsrc.
+#
+# Needs an X display with Xv but no camera. Each case plays a widget for a
+# moment and compares $w stats with what the options asked for, then
+# reconfigures the playing widget to check that it is restarted. Exits with
+# a non-zero status if any check fails.
+#
+#   wish pools.tcl ?build?
+#
+
+package require Tcl 8.6
+package require Tk 8.6
+
+set build [lindex $argv 0]
+if {$build eq ""} {
+    set build [file join [file dirname [info script]] build]
+}
+set auto_path [linsert $auto_path 0 [file normalize $build]]
+package require tkgst
+
+set failures 0
+
+proc Check {name ok detail} {
+    global failures
+    if {[uplevel 1 [list expr $ok]]} {
+        puts "ok   $name"
+    } else {
+        puts "FAIL $name: $detail"
+        incr failures
+    }
+}
+
+proc Wait {ms} {
+    after $ms [list set ::waited 1]
+    vwait ::waited
+}
+
+proc Play {w args} {
+    gst $w -device videotestsrc -width 320 -height 240 {*}$args
+    pack $w
+    update
+    $w play
+    Wait 1000
+    return [$w stats]
+}
+
+# Default negotiation must show real pools and count frames.
+set stats [Play .default]
+Check "default frames" {[dict get $stats frames] > 0} $stats
+Check "default pool size" {[dict get $stats pools convert size] > 0} $stats
+destroy .default
+
+# -buffers configures the converter's pool with exactly that many.
+set stats [Play .buffers -buffers 3]
+Check "buffers convert pool" {[dict get $stats pools convert min] == 3
+    && [dict get $stats pools convert max] == 3} $stats
+puts "     capture pool [dict get $stats pools capture]"
+destroy .buffers
+
+# Fewer buffers than the sink needs are raised to its minimum rather than
+# starving the converter.
+set stats [Play .few -buffers 1]
+Check "buffers below sink minimum" {[dict get $stats frames] > 0
+    && [dict get $stats pools convert min] >= 1} $stats
+destroy .few
+
+# -sharepool makes the converter write into the sink's pool.
+set stats [Play .share -sharepool 1]
+Check "sharepool copies" {[dict get $stats copies] == 0} $stats
+destroy .share
+
+# Changing a source option while playing must restart the pipeline.
+set stats [Play .restart]
+.restart configure -buffers 4
+Wait 1000
+set restarted [.restart stats]
+Check "restart playing" {[dict get $restarted frames] > 0
+    && [dict get $restarted pools convert min] == 4} $restarted
+destroy .restart
+
+exit [expr {$failures != 0}]
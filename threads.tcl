@@ -0,0 +1,89 @@
+# Stress the per-thread bus routing.
+#
+# Starts several threads, each with its own Tk interpreter playing a few
+# videotestsrc widgets, plus one thread whose widget is played and then
+# paused, leaving its bus routed but quiet. After a while each thread
+# reports its [gst eventstats]. Every playing thread must have handled
+# messages and none of them may belong to a bus created by another thread.
+# The paused thread must not be woken while the others play. Needs an X
+# display with Xv and the Thread package. Exits non-zero on failure.
+#
+#   tclsh threads.tcl ?-threads n? ?-widgets n? ?-seconds n? ?build?
+#
+
+package require Tcl 8.6
+package require Thread
+
+proc Worker {build widgets} {
+    return [format {
+        set auto_path [linsert $auto_path 0 %s]
+        package require Tk
+        package require tkgst
+        for {set n 0} {$n < %d} {incr n} {
+            gst .v$n -device videotestsrc -width 160 -height 120
+            pack .v$n -side left
+        }
+        update
+        foreach w [winfo children .] {
+            $w play
+        }
+        thread::wait
+    } [list $build] $widgets]
+}
+
+proc Main {args} {
+    array set opts {-threads 4 -widgets 2 -seconds 5}
+    while {[string match -* [lindex $args 0]]} {
+        set args [lassign $args opt value]
+        if {![info exists opts($opt)]} {
+            puts stderr "usage: tclsh threads.tcl ?-threads n? ?-widgets n? ?-seconds n? ?build?"
+            exit 1
+        }
+        set opts($opt) $value
+    }
+    set build [lindex $args 0]
+    if {$build eq ""} {
+        set build [file join [file dirname [info script]] build]
+    }
+    set build [file normalize $build]
+
+    set threads {}
+    for {set n 0} {$n < $opts(-threads)} {incr n} {
+        lappend threads [thread::create [Worker $build $opts(-widgets)]]
+    }
+    set idle [thread::create [Worker $build 1]]
+
+    # Pause the idle thread's pipeline once it runs and let it settle
+    # before taking the baseline, so only misrouted messages can wake it
+    # from here on.
+    after 1000 [list set ::done 1]
+    vwait ::done
+    thread::send $idle {.v0 pause}
+    after 500 [list set ::done 1]
+    vwait ::done
+    set baseline [thread::send $idle {gst eventstats}]
+
+    after [expr {$opts(-seconds) * 1000}] [list set ::done 1]
+    vwait ::done
+
+    set failures 0
+    foreach tid [linsert $threads end $idle] {
+        set stats [thread::send $tid {gst eventstats}]
+        set ok [expr {[dict get $stats messages] > 0 && [dict get $stats foreign] == 0}]
+        if {$tid eq $idle} {
+            set ok [expr {$ok && [dict get $stats wakeups] == [dict get $baseline wakeups]}]
+        }
+        puts [format "%-4s %-12s %s" [expr {$ok ? "ok" : "FAIL"}] \
+            [expr {$tid eq $idle ? "paused" : "playing"}] $stats]
+        if {!$ok} {
+            incr failures
+        }
+    }
+    foreach tid [linsert $threads end $idle] {
+        thread::send $tid {foreach w [winfo children .] {destroy $w}}
+        thread::release $tid
+    }
+    exit [expr {$failures != 0}]
+}
+
+Main {*}$argv
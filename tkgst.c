@@ -3,7 +3,12 @@
 #include <gst/video/videooverlay.h>
 #include <gst/video/navigation.h>
 #include <gst/video/colorbalance.h>
+#include <gst/video/video.h>
+#include <gst/app/gstappsink.h>
 #include <gst/gstparse.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdarg.h>
 #include <string.h>
 
 #define DEF_VIDEO_BACKGROUND   "white"
@@ -17,11 +22,32 @@
 #define DEF_VIDEO_OUTPUT       ""
 #define DEF_VIDEO_ANCHOR       "center"
 #define DEF_VIDEO_DEVICE       "/dev/video0"
+#define DEF_VIDEO_BUFFERS      "0"
+#define DEF_VIDEO_IO_MODE      "auto"
+#define DEF_VIDEO_SHARE_POOL   "0"
+#define DEF_AUDIO_DEVICE       ""
+#define DEF_LEVEL_COMMAND      ""
+
+#define LEVEL_MESSAGE_INTERVAL (10 * GST_MSECOND)
+#define LEVEL_DELIVERY_MS      33
+#define LEVEL_MAX_CHANNELS     8
+
+#define DEF_THUMBNAIL_COUNT    10
+#define DEF_THUMBNAIL_WIDTH    160
+#define DEF_THUMBNAIL_HEIGHT   90
+#define THUMBNAIL_TIMEOUT      (5 * GST_SECOND)
+#define THUMBNAIL_CACHE_BYTES  (64 * 1024 * 1024)
 
 #define VIDEO_SOURCE_CHANGED   0x01
 #define VIDEO_GEOMETRY_CHANGED 0x02
 #define VIDEO_OUTPUT_CHANGED   0x04
 
+// Values accepted by the v4l2src io-mode property.
+enum {IO_MODE_AUTO, IO_MODE_RW, IO_MODE_MMAP, IO_MODE_USERPTR, IO_MODE_DMABUF, IO_MODE_DMABUF_IMPORT};
+static const char *ioModes[] = {
+    "auto", "rw", "mmap", "userptr", "dmabuf", "dmabuf-import", NULL
+};
+
 static Tk_OptionSpec optionSpec[] = {
     {TK_OPTION_ANCHOR, "-anchor", "anchor", "Anchor",
         DEF_VIDEO_ANCHOR, Tk_Offset(WidgetData, anchorPtr), -1, 0, 0, VIDEO_GEOMETRY_CHANGED },
@@ -34,23 +60,97 @@ static Tk_OptionSpec optionSpec[] = {
     {TK_OPTION_STRING, "-width", "width", "Width",
         DEF_VIDEO_WIDTH, Tk_Offset(WidgetData, widthPtr), -1, 0, 0, VIDEO_GEOMETRY_CHANGED},
     {TK_OPTION_STRING, "-device", "device", "Device",
-        DEF_VIDEO_DEVICE, Tk_Offset(WidgetData, devicePtr), -1, 0, 0, 0},
+        DEF_VIDEO_DEVICE, Tk_Offset(WidgetData, devicePtr), -1, 0, 0, VIDEO_SOURCE_CHANGED},
+    {TK_OPTION_INT, "-buffers", "buffers", "Buffers",
+        DEF_VIDEO_BUFFERS, Tk_Offset(WidgetData, buffersPtr), Tk_Offset(WidgetData, buffers), 0, 0, VIDEO_SOURCE_CHANGED},
+    {TK_OPTION_STRING_TABLE, "-io-mode", "ioMode", "IoMode",
+        DEF_VIDEO_IO_MODE, Tk_Offset(WidgetData, ioModePtr), Tk_Offset(WidgetData, ioMode), 0, (ClientData)ioModes, VIDEO_SOURCE_CHANGED},
+    {TK_OPTION_BOOLEAN, "-sharepool", "sharePool", "SharePool",
+        DEF_VIDEO_SHARE_POOL, Tk_Offset(WidgetData, sharePoolPtr), Tk_Offset(WidgetData, sharePool), 0, 0, VIDEO_SOURCE_CHANGED},
+    {TK_OPTION_STRING, "-audiodevice", "audioDevice", "AudioDevice",
+        DEF_AUDIO_DEVICE, Tk_Offset(WidgetData, audioDevicePtr), -1, 0, 0, VIDEO_SOURCE_CHANGED},
+    {TK_OPTION_STRING, "-levelcommand", "levelCommand", "LevelCommand",
+        DEF_LEVEL_COMMAND, Tk_Offset(WidgetData, levelCommandPtr), -1, 0, 0, 0},
     {TK_OPTION_END, (char *)NULL, (char *)NULL, (char*)NULL,
         (char *)NULL, 0, 0, 0, 0}
 };
 
+enum {MONITOR_STOPPED, MONITOR_STARTING, MONITOR_STARTED, MONITOR_FAILED};
+
+// Per thread state. All interpreters in a thread share one event source and
+// the set of busses whose messages are delivered to that thread.
+typedef struct {
+    int refCount;                 /* initialized packages in this thread */
+    GList *busses;                /* busses routed to this thread */
+    GAsyncQueue *queue;           /* BusMessage items waiting for this thread */
+    int eventPending;             /* a GstTclEvent is queued */
+    GList *meters;                /* widgets with an audio level meter */
+    Tcl_TimerToken levelTimer;    /* delivers levels while there are meters */
+    Tcl_WideInt wakeups;          /* EventProc calls in this thread */
+    Tcl_WideInt messages;         /* bus messages handled */
+    Tcl_WideInt foreign;          /* of those, routed to another thread */
+} ThreadSpecificData;
+
+static Tcl_ThreadDataKey dataKey;
+
+// Sync handler data routing a bus to the thread that owns it.
+typedef struct {
+    GAsyncQueue *queue;
+    Tcl_ThreadId threadId;
+} BusRoute;
+
 typedef struct {
-    GList *busses;
-    GstDeviceMonitor *monitor;
-    GList *devices;
+    GstBus *bus;
+    GstMessage *message;
+} BusMessage;
+
+typedef struct {
+    ThreadSpecificData *tsdPtr;   /* set once initialized */
+    int initialized;              /* GStreamer and the event source are set up */
+    GstDeviceMonitor *monitor;    /* created by the first devices call */
+    GThread *monitorThread;       /* starts the monitor in the background */
+    GMutex monitorLock;
+    GCond monitorCond;
+    int monitorState;
+    Tcl_ThreadId threadId;        /* thread owning the interpreter */
+    GThreadPool *thumbnailPool;   /* decode workers, created on first use */
+    GHashTable *thumbnailCache;   /* cache key -> RGBA pixels, Tcl thread only */
+    gsize thumbnailCacheBytes;    /* pixel bytes held by the cache */
+    gint shutdown;                /* set when the package is being deleted */
 } PackageData;
 
 typedef struct {
     Tcl_Event event;
-    PackageData *package;
-    GstBus *bus;
+    ThreadSpecificData *tsdPtr;
 } GstTclEvent ;
 
+// A "gst thumbnails" call. Shared by all of its jobs; the worker threads
+// only read the immutable uri and geometry fields.
+typedef struct {
+    PackageData *package;
+    Tcl_Interp *interp;
+    Tcl_Obj *uriObj;
+    Tcl_Obj *commandObj;
+    gchar *uri;
+    gchar *cacheKey;              /* uri, mtime and geometry */
+    int count;
+    int width;
+    int height;
+    int refCount;                 /* outstanding jobs, Tcl thread only */
+} ThumbnailRequest;
+
+typedef struct {
+    ThumbnailRequest *request;
+    int index;
+    guchar *pixels;               /* RGBA width*height*4 or NULL on failure */
+    gboolean cached;              /* pixels were copied from the cache */
+} ThumbnailJob;
+
+typedef struct {
+    Tcl_Event event;
+    ThumbnailJob *job;
+} ThumbnailEvent;
+
 static int WorldChanged(ClientData clientData);
 static void CalculateGeometry(WidgetData *dataPtr);
 static int Configure(Tcl_Interp *interp, WidgetData *dataPtr, int objc, Tcl_Obj *CONST objv[]);
@@ -62,6 +162,17 @@ static int GstWidgetPauseCmd(ClientData clientData, Tcl_Interp *interp, int objc
 static int GstWidgetStopCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 static int GstWidgetDevicesCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 static int GstWidgetBalanceCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+static int GstWidgetStatsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+static int GstThumbnailsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+static int GstLogCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+static int GstEventStatsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+static void ReleaseThreadData(ThreadSpecificData *tsdPtr);
+static void ReleaseGstreamer(void);
+static void FreePackage(char *memPtr);
+static int InitPackage(Tcl_Interp *interp, PackageData *packagePtr);
+static int StartDeviceMonitor(Tcl_Interp *interp, PackageData *packagePtr, int wait);
+struct LevelMeter;
+static void AccumulateLevels(struct LevelMeter *meter, GstMessage *message);
 
 struct Ensemble {
     const char *name;          /* subcommand name */
@@ -77,9 +188,247 @@ struct Ensemble WidgetEnsemble[] = {
     { "stop",      GstWidgetStopCmd, NULL },
     { "devices",   GstWidgetDevicesCmd, NULL },
     { "balance",   GstWidgetBalanceCmd, NULL },
+    { "stats",     GstWidgetStatsCmd, NULL },
+    { NULL, NULL, NULL }
+};
+
+struct Ensemble PackageEnsemble[] = {
+    { "thumbnails", GstThumbnailsCmd, NULL },
+    { "log",        GstLogCmd, NULL },
+    { "eventstats", GstEventStatsCmd, NULL },
     { NULL, NULL, NULL }
 };
 
+/*
+ * Logging.
+ *
+ * Messages are filtered per category by level. A disabled message costs a
+ * single comparison as the arguments are only evaluated once the filter has
+ * passed. Enabled messages are formatted into a fixed size ring shared by all
+ * interpreters which can be read with "gst log", and may also be forwarded
+ * to the GStreamer debug system as the "tkgst" category.
+ */
+
+enum {LOG_ERROR, LOG_WARNING, LOG_INFO, LOG_DEBUG, LOG_TRACE, LOG_LEVEL_COUNT};
+static const char *logLevels[] = {
+    "error", "warning", "info", "debug", "trace", NULL
+};
+
+enum {LOG_CAT_WIDGET, LOG_CAT_PIPELINE, LOG_CAT_BUS, LOG_CAT_DEVICE, LOG_CAT_NAVIGATION,
+      LOG_CAT_THUMBNAIL, LOG_CAT_COUNT};
+static const char *logCategories[] = {
+    "widget", "pipeline", "bus", "device", "navigation", "thumbnail", NULL
+};
+
+#define LOG_RING_SIZE    512
+#define LOG_MESSAGE_MAX  160
+
+typedef struct {
+    guint64 seq;                  /* 1 based sequence number */
+    gint64 time;                  /* wall clock microseconds */
+    int level;
+    int category;
+    char message[LOG_MESSAGE_MAX];
+} LogEntry;
+
+// Highest level recorded for each category. Read without locking from any
+// thread; a stale value only means a message more or less is recorded.
+static volatile int logThreshold[LOG_CAT_COUNT] = {
+    LOG_WARNING, LOG_WARNING, LOG_WARNING, LOG_WARNING, LOG_WARNING, LOG_WARNING
+};
+static volatile int logForward = 0;
+static GMutex logLock;
+static guint64 logNext = 1;
+static LogEntry logRing[LOG_RING_SIZE];
+
+GST_DEBUG_CATEGORY_STATIC(tkgst_debug);
+
+#define LOG_ENABLED(cat, level) G_UNLIKELY((level) <= logThreshold[(cat)])
+#define TKGST_LOG(cat, level, ...) \
+    do { \
+        if (LOG_ENABLED((cat), (level))) \
+            LogWrite((cat), (level), __FILE__, G_STRFUNC, __LINE__, __VA_ARGS__); \
+    } while (0)
+
+static void LogWrite(int category, int level, const char *file, const char *func, int line,
+                     const char *format, ...) G_GNUC_PRINTF(6, 7);
+
+static void LogWrite(int category, int level, const char *file, const char *func, int line,
+                     const char *format, ...)
+{
+    char message[LOG_MESSAGE_MAX];
+    va_list args;
+    va_start(args, format);
+    g_vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    g_mutex_lock(&logLock);
+    LogEntry *entry = &logRing[logNext % LOG_RING_SIZE];
+    entry->seq = logNext++;
+    entry->time = g_get_real_time();
+    entry->level = level;
+    entry->category = category;
+    memcpy(entry->message, message, sizeof(message));
+    g_mutex_unlock(&logLock);
+
+#ifndef GST_DISABLE_GST_DEBUG
+    static const GstDebugLevel gstLevels[LOG_LEVEL_COUNT] = {
+        GST_LEVEL_ERROR, GST_LEVEL_WARNING, GST_LEVEL_INFO, GST_LEVEL_DEBUG, GST_LEVEL_TRACE
+    };
+    if (logForward && tkgst_debug != NULL) {
+        gst_debug_log(tkgst_debug, gstLevels[level], file, func, line, NULL,
+                      "%s: %s", logCategories[category], message);
+    }
+#endif
+}
+
+// gst log configure ?-level level? ?-categories list? ?-forward boolean?
+static int GstLogConfigureCmd(Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    enum {OPT_LEVEL, OPT_CATEGORIES, OPT_FORWARD};
+    static const char *opts[] = {
+        "-level", "-categories", "-forward", NULL
+    };
+    int level = 0, levelSet = 0, forward = -1;
+    int selected[LOG_CAT_COUNT];
+
+    if ((objc & 1) == 0) {
+        Tcl_WrongNumArgs(interp, 3, objv, "?-level level? ?-categories list? ?-forward boolean?");
+        return TCL_ERROR;
+    }
+    for (int cat = 0; cat < LOG_CAT_COUNT; ++cat) {
+        selected[cat] = 1;
+    }
+    for (int optindex = 3; optindex < objc; optindex += 2) {
+        int index = 0;
+        if (Tcl_GetIndexFromObj(interp, objv[optindex], opts, "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_LEVEL:
+                if (strcmp(Tcl_GetString(objv[optindex + 1]), "none") == 0) {
+                    level = LOG_ERROR - 1;
+                } else if (Tcl_GetIndexFromObj(interp, objv[optindex + 1], logLevels, "level", 0, &level) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                levelSet = 1;
+                break;
+            case OPT_CATEGORIES:
+                {
+                    int count = 0;
+                    Tcl_Obj **catObjs = NULL;
+                    if (Tcl_ListObjGetElements(interp, objv[optindex + 1], &count, &catObjs) != TCL_OK) {
+                        return TCL_ERROR;
+                    }
+                    memset(selected, 0, sizeof(selected));
+                    for (int n = 0; n < count; ++n) {
+                        int cat = 0;
+                        if (Tcl_GetIndexFromObj(interp, catObjs[n], logCategories, "category", 0, &cat) != TCL_OK) {
+                            return TCL_ERROR;
+                        }
+                        selected[cat] = 1;
+                    }
+                }
+                break;
+            case OPT_FORWARD:
+                if (Tcl_GetBooleanFromObj(interp, objv[optindex + 1], &forward) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+
+    if (levelSet) {
+        for (int cat = 0; cat < LOG_CAT_COUNT; ++cat) {
+            if (selected[cat])
+                logThreshold[cat] = level;
+        }
+    }
+    if (forward != -1) {
+        logForward = forward;
+    }
+
+    // Return the resulting configuration as a dict of category levels.
+    Tcl_Obj *resultObj = Tcl_NewDictObj();
+    Tcl_Obj *levelsObj = Tcl_NewDictObj();
+    for (int cat = 0; cat < LOG_CAT_COUNT; ++cat) {
+        int threshold = logThreshold[cat];
+        Tcl_DictObjPut(interp, levelsObj, Tcl_NewStringObj(logCategories[cat], -1),
+            Tcl_NewStringObj(threshold < LOG_ERROR ? "none" : logLevels[threshold], -1));
+    }
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("levels", -1), levelsObj);
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("forward", -1), Tcl_NewBooleanObj(logForward));
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+// gst log ?-since seq? ?-level level? ?-category category?
+// Returns a list of {seq time level category message} entries, oldest first.
+static int GstLogCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    enum {OPT_SINCE, OPT_LEVEL, OPT_CATEGORY};
+    static const char *opts[] = {
+        "-since", "-level", "-category", NULL
+    };
+    Tcl_WideInt since = 0;
+    int level = LOG_TRACE, category = -1;
+
+    if (objc > 2 && strcmp(Tcl_GetString(objv[2]), "configure") == 0) {
+        return GstLogConfigureCmd(interp, objc, objv);
+    }
+    if ((objc & 1) != 0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-since seq? ?-level level? ?-category category?");
+        return TCL_ERROR;
+    }
+    for (int optindex = 2; optindex < objc; optindex += 2) {
+        int index = 0;
+        if (Tcl_GetIndexFromObj(interp, objv[optindex], opts, "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_SINCE:
+                if (Tcl_GetWideIntFromObj(interp, objv[optindex + 1], &since) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_LEVEL:
+                if (Tcl_GetIndexFromObj(interp, objv[optindex + 1], logLevels, "level", 0, &level) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_CATEGORY:
+                if (Tcl_GetIndexFromObj(interp, objv[optindex + 1], logCategories, "category", 0, &category) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+
+    Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
+    g_mutex_lock(&logLock);
+    guint64 first = logNext > LOG_RING_SIZE ? logNext - LOG_RING_SIZE : 1;
+    if ((guint64)since + 1 > first) {
+        first = (guint64)since + 1;
+    }
+    for (guint64 seq = first; seq < logNext; ++seq) {
+        LogEntry *entry = &logRing[seq % LOG_RING_SIZE];
+        if (entry->level > level || (category != -1 && entry->category != category)) {
+            continue;
+        }
+        Tcl_Obj *entryObj = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(interp, entryObj, Tcl_NewWideIntObj((Tcl_WideInt)entry->seq));
+        Tcl_ListObjAppendElement(interp, entryObj, Tcl_NewWideIntObj((Tcl_WideInt)entry->time));
+        Tcl_ListObjAppendElement(interp, entryObj, Tcl_NewStringObj(logLevels[entry->level], -1));
+        Tcl_ListObjAppendElement(interp, entryObj, Tcl_NewStringObj(logCategories[entry->category], -1));
+        Tcl_ListObjAppendElement(interp, entryObj, Tcl_NewStringObj(entry->message, -1));
+        Tcl_ListObjAppendElement(interp, resultObj, entryObj);
+    }
+    g_mutex_unlock(&logLock);
+
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
 static int SetColorBalance(Tcl_Interp *interp, Tcl_Obj *valueObj, GstColorBalance *balance, GstColorBalanceChannel *channel)
 {
     double value = 0;
@@ -145,30 +494,62 @@ static int GstWidgetBalanceCmd(ClientData clientData, Tcl_Interp *interp, int ob
 
 static int GstWidgetDevicesCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
 {
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 1, objv, "devices"); // TODO: add category audio|video to select source types.
-        return TCL_ERROR;
+    static const char *opts[] = { "-async", "-class", NULL };
+    enum { OPT_ASYNC, OPT_CLASS };
+    static const char *classes[] = { "all", "audio", "video", NULL };
+    static const char *classFilters[] = { NULL, "Audio/Source", "Video/Source" };
+    int wait = 1, devClass = 0;
+    for (int n = 2; n < objc; ++n) {
+        int index = 0;
+        if (Tcl_GetIndexFromObj(interp, objv[n], opts, "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (index == OPT_ASYNC) {
+            wait = 0;
+        } else if (n + 1 == objc) {
+            Tcl_WrongNumArgs(interp, 1, objv, "devices ?-async? ?-class all|audio|video?");
+            return TCL_ERROR;
+        } else if (Tcl_GetIndexFromObj(interp, objv[++n], classes, "class", 0, &devClass) != TCL_OK) {
+            return TCL_ERROR;
+        }
     }
     WidgetData *dataPtr = (WidgetData *)clientData;
     PackageData *packagePtr = (PackageData *)dataPtr->packageData;
+
+    // With -async the monitor is started in the background and the devices
+    // known so far are returned, which is none until it has started.
+    if (StartDeviceMonitor(interp, packagePtr, wait) != TCL_OK) {
+        return TCL_ERROR;
+    }
     Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
-    GList *devices = gst_device_monitor_get_devices(GST_DEVICE_MONITOR(packagePtr->monitor));
-    for (GList *dev = packagePtr->devices; dev != NULL; dev = dev->next)
+    GList *devices = NULL;
+    g_mutex_lock(&packagePtr->monitorLock);
+    if (packagePtr->monitorState == MONITOR_STARTED) {
+        devices = gst_device_monitor_get_devices(packagePtr->monitor);
+    }
+    g_mutex_unlock(&packagePtr->monitorLock);
+    for (GList *dev = devices; dev != NULL; dev = dev->next)
     {
         GstDevice *device = GST_DEVICE(dev->data);
+        if (classFilters[devClass] != NULL && !gst_device_has_classes(device, classFilters[devClass])) {
+            continue;
+        }
         gchar *name = gst_device_get_display_name(device);
         gchar *devclass = gst_device_get_device_class(device);
         GstCaps *caps = gst_device_get_caps(device);
-        {
-            gchar *capsstr = gst_caps_serialize(caps, GST_SERIALIZE_FLAG_NONE);
-            g_message("caps: %s\n", capsstr);
-            g_free(capsstr);
+        if (caps) {
+            if (LOG_ENABLED(LOG_CAT_DEVICE, LOG_DEBUG)) {
+                gchar *capsstr = gst_caps_serialize(caps, GST_SERIALIZE_FLAG_NONE);
+                TKGST_LOG(LOG_CAT_DEVICE, LOG_DEBUG, "caps: %s", capsstr);
+                g_free(capsstr);
+            }
+            gst_caps_unref(caps);
         }
         GstStructure *props = gst_device_get_properties(device);
-        const gchar *device_path = gst_structure_get_string(props, "device.path");
-        {
+        const gchar *device_path = props ? gst_structure_get_string(props, "device.path") : NULL;
+        if (props && LOG_ENABLED(LOG_CAT_DEVICE, LOG_DEBUG)) {
             gchar *propsstr = gst_structure_serialize(props, GST_SERIALIZE_FLAG_NONE);
-            g_message("device props: %s\n", propsstr);
+            TKGST_LOG(LOG_CAT_DEVICE, LOG_DEBUG, "device props: %s", propsstr);
             g_free(propsstr);
         }
 
@@ -178,13 +559,15 @@ static int GstWidgetDevicesCmd(ClientData clientData, Tcl_Interp *interp, int ob
         Tcl_ListObjAppendElement(interp, devObj, Tcl_NewStringObj("device_class", 12));
         Tcl_ListObjAppendElement(interp, devObj, Tcl_NewStringObj(devclass, -1));
         Tcl_ListObjAppendElement(interp, devObj, Tcl_NewStringObj("path", 4));
-        Tcl_ListObjAppendElement(interp, devObj, Tcl_NewStringObj(device_path, -1));
+        Tcl_ListObjAppendElement(interp, devObj, Tcl_NewStringObj(device_path ? device_path : "", -1));
 
-        gst_structure_free(props);
+        if (props)
+            gst_structure_free(props);
         g_free(name);
         g_free(devclass);
         Tcl_ListObjAppendElement(interp, resultObj, devObj);
     }
+    g_list_free_full(devices, gst_object_unref);
     Tcl_SetObjResult(interp, resultObj);
     return TCL_OK;
 }
@@ -206,18 +589,526 @@ static GData *GetColorBalanceChannelMap(GstPipeline *pipeline)
     return channelMap;
 }
 
+/*
+ * Bus routing.
+ *
+ * Each bus has a sync handler that moves its messages onto the queue of the
+ * thread that created it and alerts that thread's notifier. The thread's
+ * event source then handles them. Messages are dropped from the bus itself
+ * so no other thread is woken and nothing needs to poll.
+ */
+
+static void FreeBusMessage(gpointer data)
+{
+    BusMessage *item = (BusMessage *)data;
+    gst_message_unref(item->message);
+    gst_object_unref(item->bus);
+    g_free(item);
+}
+
+static void FreeBusRoute(gpointer data)
+{
+    BusRoute *route = (BusRoute *)data;
+    g_async_queue_unref(route->queue);
+    g_free(route);
+}
+
+// Called on the thread posting the message.
+static GstBusSyncReply BusSyncHandler(GstBus *bus, GstMessage *message, gpointer userData)
+{
+    BusRoute *route = (BusRoute *)userData;
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ELEMENT && GST_MESSAGE_SRC(message) != NULL) {
+        struct LevelMeter *meter = g_object_get_data(G_OBJECT(GST_MESSAGE_SRC(message)), "tkgst-levels");
+        if (meter != NULL) {
+            AccumulateLevels(meter, message);
+            return GST_BUS_DROP;
+        }
+    }
+    BusMessage *item = g_new(BusMessage, 1);
+    item->bus = GST_BUS(gst_object_ref(bus));
+    item->message = gst_message_ref(message);
+    g_async_queue_push(route->queue, item);
+    Tcl_ThreadAlert(route->threadId);
+    return GST_BUS_DROP;
+}
+
+// Deliver messages from bus to the current thread. Takes over the caller's
+// reference to the bus.
+static void RouteBus(ThreadSpecificData *tsdPtr, GstBus *bus)
+{
+    BusRoute *route = g_new(BusRoute, 1);
+    route->queue = g_async_queue_ref(tsdPtr->queue);
+    route->threadId = Tcl_GetCurrentThread();
+    gst_bus_set_sync_handler(bus, BusSyncHandler, route, FreeBusRoute);
+    tsdPtr->busses = g_list_append(tsdPtr->busses, bus);
+}
+
+static void UnrouteBus(ThreadSpecificData *tsdPtr, GstBus *bus)
+{
+    GList *node = g_list_find(tsdPtr->busses, bus);
+    if (node != NULL) {
+        gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+        tsdPtr->busses = g_list_delete_link(tsdPtr->busses, node);
+        gst_object_unref(bus);
+    }
+}
+
+/*
+ * Buffer pool control.
+ *
+ * The pools are negotiated by ALLOCATION queries travelling downstream.
+ * Probes on the capture and convert source pads see each query after it
+ * has been answered and, when -buffers is set, adjust the answer the
+ * element configures its pool from. With -sharepool the converter is made
+ * to adopt the pool proposed by the sink. The pool each stage really ended
+ * up with is read from the first buffer it pushes. Buffers reaching the
+ * sink that were not allocated from the sink's own pool have to be copied
+ * by the sink and are counted as copies.
+ */
+
+enum {POOL_STAGE_CAPTURE, POOL_STAGE_CONVERT, POOL_STAGE_COUNT};
+static const char *poolStageNames[] = { "capture", "convert", NULL };
+
+typedef struct {
+    GstBufferPool *pool;          /* pool of the last buffer seen */
+    guint size;                   /* bytes per buffer */
+    guint min;                    /* buffers preallocated */
+    guint max;                    /* 0 if the pool may grow without limit */
+} PoolStage;
+
+typedef struct {
+    GMutex lock;
+    guint buffers;                /* requested buffers per pool, 0 for default */
+    gboolean sharePool;           /* converter must use the sink's pool */
+    const char *ioMode;           /* io-mode in effect on the capture element */
+    PoolStage stages[POOL_STAGE_COUNT];
+    GstBufferPool *sinkPool;      /* pool proposed by the sink */
+    guint64 frames;
+    guint64 copies;
+    gboolean haveVideo;           /* a video buffer has reached its sink */
+    gboolean haveAudio;           /* an audio buffer has reached its sink */
+    GstClockTimeDiff videoLag;    /* running time at the sink less the buffer time */
+    GstClockTimeDiff audioLag;
+} AllocStats;
+
+typedef struct {
+    AllocStats *stats;
+    int stage;
+} AllocProbe;
+
+static void FreeAllocStats(AllocStats *stats)
+{
+    for (int stage = 0; stage < POOL_STAGE_COUNT; ++stage) {
+        if (stats->stages[stage].pool)
+            gst_object_unref(stats->stages[stage].pool);
+    }
+    if (stats->sinkPool)
+        gst_object_unref(stats->sinkPool);
+    g_mutex_clear(&stats->lock);
+    g_free(stats);
+}
+
+static GstPadProbeReturn AllocationProbe(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    AllocProbe *probe = (AllocProbe *)userData;
+    AllocStats *stats = probe->stats;
+    GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+    GstBufferPool *pool = NULL;
+    guint size = 0, min = 0, max = 0;
+
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION
+        || gst_query_get_n_allocation_pools(query) == 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // The element configures its pool from the first entry, so to share
+    // the sink's pool it has to come first and be the only one.
+    guint count = gst_query_get_n_allocation_pools(query);
+    guint index = 0;
+    gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+    if (probe->stage == POOL_STAGE_CONVERT && stats->sharePool) {
+        while (pool == NULL && ++index < count) {
+            gst_query_parse_nth_allocation_pool(query, index, &pool, &size, &min, &max);
+        }
+        if (pool == NULL) {
+            TKGST_LOG(LOG_CAT_PIPELINE, LOG_WARNING, "sink offered no pool to share");
+            gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+        } else {
+            while (count > 1) {
+                gst_query_remove_nth_allocation_pool(query, --count);
+            }
+        }
+    }
+
+    if (stats->buffers > 0) {
+        if (probe->stage == POOL_STAGE_CAPTURE) {
+            // v4l2src adds the downstream minimum to the driver's own, so
+            // ask for none and cap the pool's growth instead.
+            min = 0;
+            max = stats->buffers;
+        } else {
+            // Sinks keep the last frame for redraws, so never go below the
+            // minimum they asked for or the converter waits forever.
+            min = max = MAX(stats->buffers, min);
+        }
+    }
+    gst_query_set_nth_allocation_pool(query, 0, pool, size, min, max);
+
+    if (probe->stage == POOL_STAGE_CONVERT) {
+        g_mutex_lock(&stats->lock);
+        if (stats->sinkPool)
+            gst_object_unref(stats->sinkPool);
+        stats->sinkPool = pool;
+        pool = NULL;
+        g_mutex_unlock(&stats->lock);
+    }
+
+    if (pool)
+        gst_object_unref(pool);
+    return GST_PAD_PROBE_OK;
+}
+
+// Record the configuration of the pool a stage is really using. This is
+// only read again when the stage moves to another pool.
+static GstPadProbeReturn StageBufferProbe(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    AllocProbe *probe = (AllocProbe *)userData;
+    AllocStats *stats = probe->stats;
+    PoolStage *stage = &stats->stages[probe->stage];
+    GstBufferPool *pool = GST_PAD_PROBE_INFO_BUFFER(info)->pool;
+
+    g_mutex_lock(&stats->lock);
+    if (pool != stage->pool) {
+        guint size = 0, min = 0, max = 0;
+        if (pool != NULL) {
+            GstStructure *config = gst_buffer_pool_get_config(pool);
+            gst_buffer_pool_config_get_params(config, NULL, &size, &min, &max);
+            gst_structure_free(config);
+            gst_object_ref(pool);
+        }
+        if (stage->pool)
+            gst_object_unref(stage->pool);
+        stage->pool = pool;
+        stage->size = size;
+        stage->min = min;
+        stage->max = max;
+        if (stats->buffers > 0 && min > stats->buffers) {
+            TKGST_LOG(LOG_CAT_PIPELINE, LOG_INFO, "%s pool holds %u buffers, more than the %u requested",
+                      poolStageNames[probe->stage], min, stats->buffers);
+        }
+    }
+    g_mutex_unlock(&stats->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// How far behind the pipeline clock a buffer arrives at a sink. The live
+// sources timestamp in running time so comparing the two branches gives the
+// A/V drift.
+static gboolean BufferLag(GstPad *pad, GstBuffer *buffer, GstClockTimeDiff *lag)
+{
+    gboolean valid = FALSE;
+    GstElement *elt = GST_ELEMENT(gst_pad_get_parent(pad));
+    if (elt == NULL) {
+        return FALSE;
+    }
+    GstClock *clock = gst_element_get_clock(elt);
+    if (clock != NULL && GST_BUFFER_PTS_IS_VALID(buffer)) {
+        GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(elt);
+        *lag = GST_CLOCK_DIFF(GST_BUFFER_PTS(buffer), now);
+        valid = TRUE;
+    }
+    if (clock != NULL)
+        gst_object_unref(clock);
+    gst_object_unref(elt);
+    return valid;
+}
+
+static GstPadProbeReturn SinkBufferProbe(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    AllocStats *stats = (AllocStats *)userData;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTimeDiff lag = 0;
+    gboolean haveLag = BufferLag(pad, buffer, &lag);
+
+    g_mutex_lock(&stats->lock);
+    ++stats->frames;
+    if (buffer->pool == NULL || buffer->pool != stats->sinkPool) {
+        ++stats->copies;
+    }
+    if (haveLag) {
+        stats->videoLag = lag;
+        stats->haveVideo = TRUE;
+    }
+    g_mutex_unlock(&stats->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn AudioSinkBufferProbe(GstPad *pad, GstPadProbeInfo *info, gpointer userData)
+{
+    AllocStats *stats = (AllocStats *)userData;
+    GstClockTimeDiff lag = 0;
+    if (BufferLag(pad, GST_PAD_PROBE_INFO_BUFFER(info), &lag)) {
+        g_mutex_lock(&stats->lock);
+        stats->audioLag = lag;
+        stats->haveAudio = TRUE;
+        g_mutex_unlock(&stats->lock);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void AddAllocationProbe(GstElement *pipeline, const char *name, const char *padname,
+                               AllocStats *stats, int stage)
+{
+    GstElement *elt = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    GstPad *pad = gst_element_get_static_pad(elt, padname);
+    AllocProbe *probe = g_new0(AllocProbe, 1);
+    probe->stats = stats;
+    probe->stage = stage;
+    // The PULL flag selects the query after it has been answered downstream.
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL,
+                      AllocationProbe, probe, g_free);
+    probe = g_memdup2(probe, sizeof(AllocProbe));
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, StageBufferProbe, probe, g_free);
+    gst_object_unref(pad);
+    gst_object_unref(elt);
+}
+
+// A -device or -audiodevice value is either the name of a source element,
+// such as videotestsrc or pulsesrc, or a device for the fallback element.
+static const char *SourceFactoryName(const char *device, const char *fallback)
+{
+    GstElementFactory *factory = gst_element_factory_find(device);
+    if (factory == NULL) {
+        return fallback;
+    }
+    gst_object_unref(factory);
+    return device;
+}
+
+static void ConfigureSource(GstElement *src, const char *device)
+{
+    GObjectClass *klass = G_OBJECT_GET_CLASS(src);
+    if (g_object_class_find_property(klass, "is-live")) {
+        g_object_set(src, "is-live", TRUE, NULL);
+    }
+    if (strcmp(GST_OBJECT_NAME(gst_element_get_factory(src)), device) != 0
+        && g_object_class_find_property(klass, "device")) {
+        g_object_set(src, "device", device, NULL);
+    }
+}
+
+// Set the capture io-mode if the element supports it. Unknown modes fall
+// back to auto so that the same script works across v4l2src versions.
+static const char *SetCaptureIoMode(GstElement *src, const char *mode)
+{
+    GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(src), "io-mode");
+    if (pspec == NULL || !G_IS_PARAM_SPEC_ENUM(pspec)) {
+        return ioModes[IO_MODE_AUTO];
+    }
+    if (g_enum_get_value_by_nick(G_PARAM_SPEC_ENUM(pspec)->enum_class, mode) == NULL) {
+        TKGST_LOG(LOG_CAT_PIPELINE, LOG_WARNING, "io-mode \"%s\" not supported, using auto", mode);
+        mode = ioModes[IO_MODE_AUTO];
+    }
+    gst_util_set_object_arg(G_OBJECT(src), "io-mode", mode);
+    return mode;
+}
+
+/*
+ * Audio level metering.
+ *
+ * The level element posts a message per channel set every
+ * LEVEL_MESSAGE_INTERVAL. These are intercepted by the bus sync handler on
+ * the streaming thread and folded into the widget's LevelMeter, so they
+ * never reach the Tk thread. A timer in each thread then delivers the
+ * accumulated readings of all its meters to their -levelcommand callbacks
+ * every LEVEL_DELIVERY_MS. The timer only runs while one of those widgets
+ * is playing.
+ */
+
+typedef struct LevelMeter {
+    GMutex lock;
+    int channels;
+    double peak[LEVEL_MAX_CHANNELS];   /* highest peak in dB since delivery */
+    double power[LEVEL_MAX_CHANNELS];  /* sum of linear rms power */
+    int count;                         /* level messages accumulated */
+} LevelMeter;
+
+static LevelMeter *NewLevelMeter(void)
+{
+    LevelMeter *meter = g_new0(LevelMeter, 1);
+    g_mutex_init(&meter->lock);
+    return meter;
+}
+
+static void FreeLevelMeter(LevelMeter *meter)
+{
+    g_mutex_clear(&meter->lock);
+    g_free(meter);
+}
+
+// Called on the streaming thread with a "level" element message.
+static void AccumulateLevels(LevelMeter *meter, GstMessage *message)
+{
+    const GstStructure *s = gst_message_get_structure(message);
+    if (s == NULL || !gst_structure_has_name(s, "level")) {
+        return;
+    }
+    const GValue *peakValue = gst_structure_get_value(s, "peak");
+    const GValue *rmsValue = gst_structure_get_value(s, "rms");
+    if (peakValue == NULL || rmsValue == NULL) {
+        return;
+    }
+
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GValueArray *peaks = (GValueArray *)g_value_get_boxed(peakValue);
+    GValueArray *rms = (GValueArray *)g_value_get_boxed(rmsValue);
+    int channels = (int)MIN(MIN(peaks->n_values, rms->n_values), LEVEL_MAX_CHANNELS);
+
+    g_mutex_lock(&meter->lock);
+    if (meter->count == 0 || channels != meter->channels) {
+        meter->channels = channels;
+        meter->count = 0;
+        for (int n = 0; n < channels; ++n) {
+            meter->peak[n] = -INFINITY;
+            meter->power[n] = 0.0;
+        }
+    }
+    for (int n = 0; n < channels; ++n) {
+        double peak = g_value_get_double(g_value_array_get_nth(peaks, n));
+        double level = g_value_get_double(g_value_array_get_nth(rms, n));
+        meter->peak[n] = MAX(meter->peak[n], peak);
+        meter->power[n] += pow(10.0, level / 10.0);
+    }
+    ++meter->count;
+    g_mutex_unlock(&meter->lock);
+G_GNUC_END_IGNORE_DEPRECATIONS
+}
+
+// Call {*}levelcommand peaks rms for one widget if readings have arrived,
+// with the peak and mean rms of each channel in dB.
+static void DeliverLevels(WidgetData *dataPtr)
+{
+    LevelMeter *meter = (LevelMeter *)dataPtr->levelMeter;
+    double peak[LEVEL_MAX_CHANNELS], power[LEVEL_MAX_CHANNELS];
+    int channels = 0, count = 0;
+
+    g_mutex_lock(&meter->lock);
+    channels = meter->channels;
+    count = meter->count;
+    memcpy(peak, meter->peak, sizeof(peak));
+    memcpy(power, meter->power, sizeof(power));
+    meter->count = 0;
+    g_mutex_unlock(&meter->lock);
+
+    if (count == 0 || dataPtr->levelCommandPtr == NULL
+        || Tcl_GetCharLength(dataPtr->levelCommandPtr) == 0) {
+        return;
+    }
+
+    Tcl_Interp *interp = dataPtr->interp;
+    Tcl_Obj *peaksObj = Tcl_NewListObj(0, NULL);
+    Tcl_Obj *rmsObj = Tcl_NewListObj(0, NULL);
+    for (int n = 0; n < channels; ++n) {
+        Tcl_ListObjAppendElement(interp, peaksObj, Tcl_NewDoubleObj(peak[n]));
+        Tcl_ListObjAppendElement(interp, rmsObj, Tcl_NewDoubleObj(10.0 * log10(power[n] / count)));
+    }
+    Tcl_Obj *cmdObj = Tcl_DuplicateObj(dataPtr->levelCommandPtr);
+    Tcl_IncrRefCount(cmdObj);
+    Tcl_ListObjAppendElement(interp, cmdObj, peaksObj);
+    Tcl_ListObjAppendElement(interp, cmdObj, rmsObj);
+    Tcl_Preserve(interp);
+    int r = Tcl_EvalObjEx(interp, cmdObj, TCL_EVAL_GLOBAL);
+    if (r != TCL_OK) {
+        Tcl_BackgroundException(interp, r);
+    }
+    Tcl_Release(interp);
+    Tcl_DecrRefCount(cmdObj);
+}
+
+static void LevelTimerProc(ClientData clientData)
+{
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)clientData;
+    tsdPtr->levelTimer = Tcl_CreateTimerHandler(LEVEL_DELIVERY_MS, LevelTimerProc, clientData);
+
+    // Callbacks may destroy widgets so work from a preserved copy.
+    GList *meters = g_list_copy(tsdPtr->meters);
+    for (GList *node = meters; node != NULL; node = node->next) {
+        Tcl_Preserve(node->data);
+    }
+    for (GList *node = meters; node != NULL; node = node->next) {
+        WidgetData *dataPtr = (WidgetData *)node->data;
+        if (dataPtr->levelMeter != NULL) {
+            DeliverLevels(dataPtr);
+        }
+        Tcl_Release(node->data);
+    }
+    g_list_free(meters);
+}
+
+static void AddLevelMeter(ThreadSpecificData *tsdPtr, WidgetData *dataPtr)
+{
+    tsdPtr->meters = g_list_append(tsdPtr->meters, dataPtr);
+    if (tsdPtr->levelTimer == NULL) {
+        tsdPtr->levelTimer = Tcl_CreateTimerHandler(LEVEL_DELIVERY_MS, LevelTimerProc, (ClientData)tsdPtr);
+    }
+}
+
+static void RemoveLevelMeter(ThreadSpecificData *tsdPtr, WidgetData *dataPtr)
+{
+    tsdPtr->meters = g_list_remove(tsdPtr->meters, dataPtr);
+    if (tsdPtr->meters == NULL && tsdPtr->levelTimer != NULL) {
+        Tcl_DeleteTimerHandler(tsdPtr->levelTimer);
+        tsdPtr->levelTimer = NULL;
+    }
+}
+
+// Meters are only delivered while their pipeline plays so that paused or
+// stopped widgets do not keep the timer waking the thread.
+static void SetLevelMeterActive(WidgetData *dataPtr, int active)
+{
+    ThreadSpecificData *tsdPtr = ((PackageData *)dataPtr->packageData)->tsdPtr;
+    if (dataPtr->levelMeter == NULL) {
+        return;
+    }
+    int registered = g_list_find(tsdPtr->meters, dataPtr) != NULL;
+    if (active && !registered) {
+        AddLevelMeter(tsdPtr, dataPtr);
+    } else if (!active && registered) {
+        RemoveLevelMeter(tsdPtr, dataPtr);
+    }
+}
+
+// Build the description of the optional audio branch, falling back to
+// alsasrc when -audiodevice does not name an element.
+static gchar *AudioBranchDescription(const char *device)
+{
+    const char *branch = " %s name=audiosrc ! audioconvert ! level name=level interval=%" G_GUINT64_FORMAT
+        " ! fakesink name=audiosink sync=true async=false";
+    return g_strdup_printf(branch, SourceFactoryName(device, "alsasrc"), (guint64)LEVEL_MESSAGE_INTERVAL);
+}
+
 static GstPipeline *CreateVideoPipeline(WidgetData *dataPtr, const gchar *name, guintptr window_id)
 {
-    const char *desc = "v4l2src device=%s ! videoconvert ! videoscale ! videobalance ! xvimagesink";
-    Tcl_Obj *descObj = Tcl_ObjPrintf(desc, Tcl_GetString(dataPtr->devicePtr));
+    const char *desc = "%s name=src ! videoconvert name=convert ! videoscale"
+        " ! videobalance ! xvimagesink name=sink";
+    const char *device = Tcl_GetString(dataPtr->devicePtr);
+    const char *audioDevice = dataPtr->audioDevicePtr ? Tcl_GetString(dataPtr->audioDevicePtr) : "";
+    Tcl_Obj *descObj = Tcl_ObjPrintf(desc, SourceFactoryName(device, "v4l2src"));
+    Tcl_IncrRefCount(descObj);
+    if (audioDevice[0] != '\0') {
+        gchar *branch = AudioBranchDescription(audioDevice);
+        Tcl_AppendToObj(descObj, branch, -1);
+        g_free(branch);
+    }
 
     GError *err = NULL;
     GstParseFlags flags = GST_PARSE_FLAG_NONE;
     GstParseContext *parseContext = gst_parse_context_new();
     GstElement *parsed = gst_parse_launch_full(Tcl_GetString(descObj), parseContext, flags, &err);
     gst_parse_context_free(parseContext);
+    Tcl_DecrRefCount(descObj);
     if (err) {
-        GST_ERROR("pipeline error: %s\n", err->message);
+        TKGST_LOG(LOG_CAT_PIPELINE, LOG_ERROR, "pipeline error: %s", err->message);
         g_error_free(err);
         return NULL;
     }
@@ -226,6 +1117,42 @@ static GstPipeline *CreateVideoPipeline(WidgetData *dataPtr, const gchar *name,
     gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (sink), window_id);
     GstPipeline *pipeline = GST_PIPELINE(parsed);
 
+    int ioMode = (dataPtr->flags & IO_MODE_FALLBACK) ? IO_MODE_AUTO : dataPtr->ioMode;
+    AllocStats *stats = g_new0(AllocStats, 1);
+    g_mutex_init(&stats->lock);
+    stats->buffers = (guint)MAX(dataPtr->buffers, 0);
+    stats->sharePool = dataPtr->sharePool;
+    GstElement *src = gst_bin_get_by_name(GST_BIN(parsed), "src");
+    ConfigureSource(src, device);
+    stats->ioMode = SetCaptureIoMode(src, ioModes[ioMode]);
+    gst_object_unref(src);
+    AddAllocationProbe(parsed, "src", "src", stats, POOL_STAGE_CAPTURE);
+    AddAllocationProbe(parsed, "convert", "src", stats, POOL_STAGE_CONVERT);
+    GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_BUFFER, SinkBufferProbe, stats, NULL);
+    gst_object_unref(sinkpad);
+    gst_object_unref(sink);
+    dataPtr->allocStats = (ClientData)stats;
+
+    if (audioDevice[0] != '\0') {
+        GstElement *audiosrc = gst_bin_get_by_name(GST_BIN(parsed), "audiosrc");
+        ConfigureSource(audiosrc, audioDevice);
+        gst_object_unref(audiosrc);
+
+        GstElement *audiosink = gst_bin_get_by_name(GST_BIN(parsed), "audiosink");
+        GstPad *audiopad = gst_element_get_static_pad(audiosink, "sink");
+        gst_pad_add_probe(audiopad, GST_PAD_PROBE_TYPE_BUFFER, AudioSinkBufferProbe, stats, NULL);
+        gst_object_unref(audiopad);
+        gst_object_unref(audiosink);
+
+        // The bus sync handler finds the meter from the message source.
+        LevelMeter *meter = NewLevelMeter();
+        GstElement *level = gst_bin_get_by_name(GST_BIN(parsed), "level");
+        g_object_set_data(G_OBJECT(level), "tkgst-levels", meter);
+        gst_object_unref(level);
+        dataPtr->levelMeter = (ClientData)meter;
+    }
+
 #ifdef MANUAL_CONSTRUCTION
     GstPipeline *pipeline = GST_PIPELINE(gst_pipeline_new(name));
 
@@ -245,10 +1172,147 @@ static GstPipeline *CreateVideoPipeline(WidgetData *dataPtr, const gchar *name,
     return pipeline;
 }
 
+// Create the widget pipeline and route its bus to this thread.
+static GstPipeline *OpenVideoPipeline(WidgetData *dataPtr)
+{
+    PackageData *packagePtr = (PackageData *)dataPtr->packageData;
+    GstPipeline *pipeline = CreateVideoPipeline(dataPtr, Tk_Name(dataPtr->tkwin), Tk_WindowId(dataPtr->tkwin));
+    if (pipeline != NULL) {
+        dataPtr->platformData = (ClientData)pipeline;
+        GstBus *bus = gst_pipeline_get_bus(pipeline);
+        g_object_set_data(G_OBJECT(bus), "tkgst-widget", dataPtr);
+        g_object_set_data(G_OBJECT(bus), "tkgst-owner", (gpointer)packagePtr->threadId);
+        RouteBus(packagePtr->tsdPtr, bus);
+        dataPtr->channelMap = (ClientData)GetColorBalanceChannelMap(pipeline);
+    }
+    return pipeline;
+}
+
+// Stop and release the widget pipeline and unregister its bus.
+static void CloseVideoPipeline(WidgetData *dataPtr)
+{
+    PackageData *packagePtr = (PackageData *)dataPtr->packageData;
+    GstPipeline *pipeline = (GstPipeline *)dataPtr->platformData;
+    if (pipeline == NULL) {
+        return;
+    }
+    gst_element_set_state(GST_ELEMENT(pipeline), GST_STATE_NULL);
+
+    GstBus *bus = gst_pipeline_get_bus(pipeline);
+    UnrouteBus(packagePtr->tsdPtr, bus);
+    g_object_set_data(G_OBJECT(bus), "tkgst-widget", NULL);
+    gst_object_unref(bus);
+
+    GData *channelMap = (GData *)dataPtr->channelMap;
+    g_datalist_clear(&channelMap);
+    dataPtr->channelMap = NULL;
+    gst_object_unref(pipeline);
+    dataPtr->platformData = NULL;
+    FreeAllocStats((AllocStats *)dataPtr->allocStats);
+    dataPtr->allocStats = NULL;
+    if (dataPtr->levelMeter != NULL) {
+        SetLevelMeterActive(dataPtr, 0);
+        FreeLevelMeter((LevelMeter *)dataPtr->levelMeter);
+        dataPtr->levelMeter = NULL;
+    }
+}
+
+// Rebuild the pipeline after the source options changed or the requested
+// io-mode failed, returning it to the state it was in.
+static void RestartVideoPipeline(ClientData clientData)
+{
+    WidgetData *dataPtr = (WidgetData *)clientData;
+    GstState state = GST_STATE_NULL, pending = GST_STATE_VOID_PENDING;
+
+    dataPtr->flags &= ~RESTART_PENDING;
+    if (dataPtr->platformData == NULL) {
+        return;
+    }
+    // Restore the state the pipeline was heading for, or had settled in.
+    gst_element_get_state(GST_ELEMENT(dataPtr->platformData), &state, &pending, 0);
+    if (pending != GST_STATE_VOID_PENDING) {
+        state = pending;
+    }
+    CloseVideoPipeline(dataPtr);
+    if (state > GST_STATE_READY) {
+        GstPipeline *pipeline = OpenVideoPipeline(dataPtr);
+        if (pipeline != NULL) {
+            gst_element_set_state(GST_ELEMENT(pipeline), state);
+            SetLevelMeterActive(dataPtr, state == GST_STATE_PLAYING);
+        }
+    }
+}
+
+static void ScheduleRestart(WidgetData *dataPtr)
+{
+    if (!(dataPtr->flags & RESTART_PENDING)) {
+        Tcl_DoWhenIdle(RestartVideoPipeline, (ClientData)dataPtr);
+        dataPtr->flags |= RESTART_PENDING;
+    }
+}
+
+// Called for errors posted on a widget pipeline bus. If a non-default
+// io-mode was in use, retry once with the driver's default.
+static void HandlePipelineError(WidgetData *dataPtr)
+{
+    AllocStats *stats = (AllocStats *)dataPtr->allocStats;
+    if (stats == NULL || (dataPtr->flags & IO_MODE_FALLBACK)
+        || strcmp(stats->ioMode, ioModes[IO_MODE_AUTO]) == 0) {
+        return;
+    }
+    TKGST_LOG(LOG_CAT_PIPELINE, LOG_WARNING, "io-mode \"%s\" failed, falling back to auto", stats->ioMode);
+    dataPtr->flags |= IO_MODE_FALLBACK;
+    ScheduleRestart(dataPtr);
+}
+
+static int GstWidgetStatsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    WidgetData *dataPtr = (WidgetData *)clientData;
+    AllocStats *stats = (AllocStats *)dataPtr->allocStats;
+    guint64 bytes = 0;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "stats");
+        return TCL_ERROR;
+    }
+    if (stats == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("pipeline is not created", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *resultObj = Tcl_NewDictObj();
+    Tcl_Obj *poolsObj = Tcl_NewDictObj();
+    g_mutex_lock(&stats->lock);
+    for (int stage = 0; stage < POOL_STAGE_COUNT; ++stage) {
+        PoolStage *pool = &stats->stages[stage];
+        guint64 held = (guint64)pool->size * pool->min;
+        Tcl_Obj *poolObj = Tcl_NewDictObj();
+        Tcl_DictObjPut(interp, poolObj, Tcl_NewStringObj("size", -1), Tcl_NewWideIntObj(pool->size));
+        Tcl_DictObjPut(interp, poolObj, Tcl_NewStringObj("min", -1), Tcl_NewWideIntObj(pool->min));
+        Tcl_DictObjPut(interp, poolObj, Tcl_NewStringObj("max", -1), Tcl_NewWideIntObj(pool->max));
+        Tcl_DictObjPut(interp, poolObj, Tcl_NewStringObj("bytes", -1), Tcl_NewWideIntObj((Tcl_WideInt)held));
+        Tcl_DictObjPut(interp, poolsObj, Tcl_NewStringObj(poolStageNames[stage], -1), poolObj);
+        bytes += held;
+    }
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("io-mode", -1), Tcl_NewStringObj(stats->ioMode, -1));
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("pools", -1), poolsObj);
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("bytes", -1), Tcl_NewWideIntObj((Tcl_WideInt)bytes));
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("frames", -1), Tcl_NewWideIntObj((Tcl_WideInt)stats->frames));
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("copies", -1), Tcl_NewWideIntObj((Tcl_WideInt)stats->copies));
+    if (stats->haveVideo && stats->haveAudio) {
+        // Positive when video arrives later than audio, in milliseconds.
+        double drift = (double)(stats->videoLag - stats->audioLag) / GST_MSECOND;
+        Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("avdrift", -1), Tcl_NewDoubleObj(drift));
+    }
+    g_mutex_unlock(&stats->lock);
+
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
 static int GstWidgetPlayCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
 {
     WidgetData *dataPtr = (WidgetData *)clientData;
-    PackageData *packagePtr = (PackageData *)dataPtr->packageData;
 
     if (objc != 2) {
         Tcl_WrongNumArgs(interp, 1, objv, "play");
@@ -256,19 +1320,14 @@ static int GstWidgetPlayCmd(ClientData clientData, Tcl_Interp *interp, int objc,
     }
     GstPipeline *pipeline = (GstPipeline *)dataPtr->platformData;
     if (pipeline == NULL) {
-        pipeline = CreateVideoPipeline(dataPtr, Tk_Name(dataPtr->tkwin), Tk_WindowId(dataPtr->tkwin));
+        pipeline = OpenVideoPipeline(dataPtr);
     }
-    if (pipeline != NULL) {
-        dataPtr->platformData = (ClientData)pipeline;
-        // Register the pipeline bus with the Tcl notifier
-        GstBus *bus = gst_pipeline_get_bus(pipeline);
-        packagePtr->busses = g_list_append(packagePtr->busses, bus);
-        dataPtr->channelMap = (ClientData)GetColorBalanceChannelMap(pipeline);
-    } else {
+    if (pipeline == NULL) {
         return TCL_ERROR;
     }
 
     GstStateChangeReturn r = gst_element_set_state(GST_ELEMENT(pipeline), GST_STATE_PLAYING);
+    SetLevelMeterActive(dataPtr, r != GST_STATE_CHANGE_FAILURE);
     static const char *states[] = { "failure", "success", "async", "no_preroll", NULL };
     Tcl_SetObjResult(interp, Tcl_NewStringObj(states[(int)r], -1));
     return TCL_OK;
@@ -282,7 +1341,12 @@ static int GstWidgetPauseCmd(ClientData clientData, Tcl_Interp *interp, int objc
     }
     WidgetData *dataPtr = (WidgetData *)clientData;
     GstPipeline *pipeline = (GstPipeline *)dataPtr->platformData;
+    if (pipeline == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("pipeline is not created", -1));
+        return TCL_ERROR;
+    }
     GstStateChangeReturn r = gst_element_set_state (GST_ELEMENT(pipeline), GST_STATE_PAUSED);
+    SetLevelMeterActive(dataPtr, 0);
     return TCL_OK;
 }
 
@@ -295,7 +1359,11 @@ static int GstWidgetStopCmd(ClientData clientData, Tcl_Interp *interp, int objc,
     WidgetData *dataPtr = (WidgetData *)clientData;
     PackageData *packagePtr = (PackageData *)dataPtr->packageData;
     GstPipeline *pipeline = (GstPipeline *)dataPtr->platformData;
+    if (pipeline == NULL) {
+        return TCL_OK;
+    }
     GstStateChangeReturn r = gst_element_set_state (GST_ELEMENT(pipeline), GST_STATE_NULL);
+    SetLevelMeterActive(dataPtr, 0);
     return TCL_OK;
 }
 
@@ -378,6 +1446,14 @@ static int Configure(Tcl_Interp *interp, WidgetData *dataPtr, int objc, Tcl_Obj
 
         CalculateGeometry(dataPtr);
 
+        // Source options apply when the pipeline is next built.
+        if (flags & VIDEO_SOURCE_CHANGED) {
+            dataPtr->flags &= ~IO_MODE_FALLBACK;
+            if (dataPtr->platformData != NULL) {
+                ScheduleRestart(dataPtr);
+            }
+        }
+
         r = WorldChanged((ClientData)dataPtr);
     }
     return r;
@@ -419,11 +1495,12 @@ static int WorldChanged(ClientData clientData)
 
 static void GstWidgetCleanup(char *memPtr)
 {
-    g_message("tk widget cleanup");
+    TKGST_LOG(LOG_CAT_WIDGET, LOG_DEBUG, "tk widget cleanup");
     //Clear up the GStreamer pipeline and unregister the bus
     WidgetData *dataPtr = (WidgetData *)memPtr;
     GData *channelMap = (GData *)dataPtr->channelMap;
     g_datalist_clear(&channelMap);
+    Tcl_Release(dataPtr->packageData);
     ckfree(memPtr);
 }
 
@@ -445,7 +1522,7 @@ static void GstWidgetEventProc(ClientData clientData, XEvent *eventPtr)
 
     } else if (eventPtr->type == DestroyNotify) {
         if (dataPtr->tkwin != NULL) {
-            g_message("tk event proc destroynotify %s", Tk_Name(dataPtr->tkwin));
+            TKGST_LOG(LOG_CAT_WIDGET, LOG_DEBUG, "tk event proc destroynotify %s", Tk_Name(dataPtr->tkwin));
             Tk_FreeConfigOptions((char *)dataPtr, dataPtr->optionTable, dataPtr->tkwin);
             Tcl_DeleteCommandFromToken(dataPtr->interp, dataPtr->widgetCmd);
         }
@@ -453,6 +1530,10 @@ static void GstWidgetEventProc(ClientData clientData, XEvent *eventPtr)
             Tcl_CancelIdleCall(GstWidgetDisplay, clientData);
             dataPtr->flags &= ~REDRAW_PENDING;
         }
+        if (dataPtr->flags & RESTART_PENDING) {
+            Tcl_CancelIdleCall(RestartVideoPipeline, clientData);
+            dataPtr->flags &= ~RESTART_PENDING;
+        }
         Tcl_EventuallyFree(clientData, GstWidgetCleanup);
     }
 }
@@ -461,19 +1542,378 @@ static void GstWidgetDeleteProc(ClientData clientData)
 {
     WidgetData *dataPtr = (WidgetData *)clientData;
     if (dataPtr->tkwin != NULL) {
-        g_message("tk widget delete proc %s", Tk_Name(dataPtr->tkwin));
+        TKGST_LOG(LOG_CAT_WIDGET, LOG_DEBUG, "tk widget delete proc %s", Tk_Name(dataPtr->tkwin));
         if (dataPtr->platformData != NULL) {
-            g_message("cleanup gst pipeline");
-            gst_object_unref(GST_ELEMENT(dataPtr->platformData));
+            TKGST_LOG(LOG_CAT_PIPELINE, LOG_DEBUG, "cleanup gst pipeline");
+            CloseVideoPipeline(dataPtr);
         }
         Tk_DestroyWindow(dataPtr->tkwin);
         dataPtr->tkwin = NULL;
     }
 }
 
-static int GstWidgetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+/*
+ * Thumbnail generation.
+ *
+ * Each requested position is decoded by its own short-lived pipeline
+ * (uridecodebin ! videoconvert ! videoscale ! appsink) on a bounded pool of
+ * worker threads. The pipeline is prerolled, seeked to the nearest keyframe
+ * and the preroll sample copied out as RGBA. Results are queued back to the
+ * interpreter thread as Tcl events where they become photo images and are
+ * cached by uri, mtime and geometry. The cache is emptied whenever it would
+ * grow beyond THUMBNAIL_CACHE_BYTES of pixels.
+ */
+
+static guchar *DecodeThumbnail(const gchar *uri, int index, int count, int width, int height)
+{
+    const char *desc = "uridecodebin name=src expose-all-streams=false caps=video/x-raw"
+        " ! videoconvert ! videoscale"
+        " ! video/x-raw,format=RGBA,width=%d,height=%d,pixel-aspect-ratio=1/1"
+        " ! appsink name=sink sync=false max-buffers=1";
+    guchar *pixels = NULL;
+    GError *err = NULL;
+
+    gchar *descstr = g_strdup_printf(desc, width, height);
+    GstElement *pipeline = gst_parse_launch(descstr, &err);
+    g_free(descstr);
+    if (err) {
+        TKGST_LOG(LOG_CAT_THUMBNAIL, LOG_ERROR, "thumbnail pipeline error: %s", err->message);
+        g_error_free(err);
+        if (pipeline)
+            gst_object_unref(pipeline);
+        return NULL;
+    }
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(src, "uri", uri, NULL);
+    gst_object_unref(src);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (gst_element_get_state(pipeline, NULL, NULL, THUMBNAIL_TIMEOUT) == GST_STATE_CHANGE_SUCCESS) {
+        gint64 duration = 0;
+        if (gst_element_query_duration(pipeline, GST_FORMAT_TIME, &duration) && duration > 0) {
+            // Take the middle of each of the count equal slices of the stream.
+            gint64 position = gst_util_uint64_scale(duration, 2 * index + 1, 2 * count);
+            if (gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+                    GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, position)) {
+                gst_element_get_state(pipeline, NULL, NULL, THUMBNAIL_TIMEOUT);
+            }
+        }
+
+        GstSample *sample = gst_app_sink_try_pull_preroll(GST_APP_SINK(sink), THUMBNAIL_TIMEOUT);
+        if (sample) {
+            GstVideoInfo info;
+            GstVideoFrame frame;
+            if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample))
+                && GST_VIDEO_INFO_WIDTH(&info) == width
+                && GST_VIDEO_INFO_HEIGHT(&info) == height
+                && gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+                // Repack the rows as the frame stride may include padding.
+                const guchar *data = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+                gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+                pixels = g_malloc((gsize)width * height * 4);
+                for (int row = 0; row < height; ++row) {
+                    memcpy(pixels + (gsize)row * width * 4, data + (gsize)row * stride, (gsize)width * 4);
+                }
+                gst_video_frame_unmap(&frame);
+            }
+            gst_sample_unref(sample);
+        }
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return pixels;
+}
+
+static void ThumbnailRequestRelease(ThumbnailRequest *request)
+{
+    if (--request->refCount > 0) {
+        return;
+    }
+    Tcl_DecrRefCount(request->uriObj);
+    Tcl_DecrRefCount(request->commandObj);
+    Tcl_Release(request->interp);
+    g_free(request->uri);
+    g_free(request->cacheKey);
+    Tcl_Free((char *)request);
+}
+
+static void ThumbnailJobFree(ThumbnailJob *job)
+{
+    ThumbnailRequestRelease(job->request);
+    g_free(job->pixels);
+    Tcl_Free((char *)job);
+}
+
+static gchar *ThumbnailCacheKey(ThumbnailJob *job)
+{
+    return g_strdup_printf("%s#%d", job->request->cacheKey, job->index);
+}
+
+// Create a new photo image holding the RGBA thumbnail pixels.
+static Tcl_Obj *CreateThumbnailImage(Tcl_Interp *interp, guchar *pixels, int width, int height)
+{
+    if (Tcl_Eval(interp, "image create photo") != TCL_OK) {
+        return NULL;
+    }
+    Tcl_Obj *imageObj = Tcl_GetObjResult(interp);
+    Tk_PhotoHandle photo = Tk_FindPhoto(interp, Tcl_GetString(imageObj));
+
+    Tk_PhotoImageBlock block;
+    block.pixelPtr = pixels;
+    block.width = width;
+    block.height = height;
+    block.pitch = width * 4;
+    block.pixelSize = 4;
+    block.offset[0] = 0;
+    block.offset[1] = 1;
+    block.offset[2] = 2;
+    block.offset[3] = 3;
+    if (photo == NULL
+        || Tk_PhotoPutBlock(interp, photo, &block, 0, 0, width, height, TK_PHOTO_COMPOSITE_SET) != TCL_OK) {
+        return NULL;
+    }
+    return imageObj;
+}
+
+// Deliver a completed thumbnail to the Tcl callback as
+//   {*}command uri index image
+// The image is empty if the position could not be decoded.
+static int ThumbnailEventProc(Tcl_Event *evPtr, int flags)
+{
+    ThumbnailEvent *event = (ThumbnailEvent *)evPtr;
+    ThumbnailJob *job = event->job;
+    ThumbnailRequest *request = job->request;
+    PackageData *packagePtr = request->package;
+    Tcl_Interp *interp = request->interp;
+    guchar *pixels = NULL;
+    int r = TCL_OK;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+        return 0;
+    }
+
+    // Jobs own their pixels until here, so clearing the cache cannot take
+    // them from events that are still queued.
+    pixels = job->pixels;
+    if (pixels != NULL && !job->cached) {
+        gsize size = (gsize)request->width * request->height * 4;
+        gchar *key = ThumbnailCacheKey(job);
+        if (size <= THUMBNAIL_CACHE_BYTES && !g_hash_table_contains(packagePtr->thumbnailCache, key)) {
+            if (packagePtr->thumbnailCacheBytes + size > THUMBNAIL_CACHE_BYTES) {
+                g_hash_table_remove_all(packagePtr->thumbnailCache);
+                packagePtr->thumbnailCacheBytes = 0;
+            }
+            g_hash_table_insert(packagePtr->thumbnailCache, key, pixels);
+            packagePtr->thumbnailCacheBytes += size;
+            job->pixels = NULL;
+        } else {
+            g_free(key);
+        }
+    }
+
+    Tcl_Obj *imageObj = NULL;
+    if (pixels != NULL) {
+        // The cache may be cleared by the callback so use the pixels first.
+        imageObj = CreateThumbnailImage(interp, pixels, request->width, request->height);
+        if (imageObj == NULL) {
+            r = TCL_ERROR;
+        }
+    } else {
+        imageObj = Tcl_NewObj();
+    }
+
+    if (r == TCL_OK) {
+        Tcl_Obj *cmdObj = Tcl_DuplicateObj(request->commandObj);
+        Tcl_IncrRefCount(cmdObj);
+        Tcl_ListObjAppendElement(interp, cmdObj, request->uriObj);
+        Tcl_ListObjAppendElement(interp, cmdObj, Tcl_NewIntObj(job->index));
+        Tcl_ListObjAppendElement(interp, cmdObj, imageObj);
+        r = Tcl_EvalObjEx(interp, cmdObj, TCL_EVAL_GLOBAL);
+        Tcl_DecrRefCount(cmdObj);
+    }
+    if (r != TCL_OK) {
+        Tcl_BackgroundException(interp, r);
+    }
+
+    ThumbnailJobFree(job);
+    return 1;
+}
+
+// Remove any undelivered thumbnail events belonging to a package being deleted.
+static int ThumbnailEventDeleteProc(Tcl_Event *evPtr, ClientData clientData)
+{
+    if (evPtr->proc == ThumbnailEventProc) {
+        ThumbnailEvent *event = (ThumbnailEvent *)evPtr;
+        if (event->job->request->package == (PackageData *)clientData) {
+            ThumbnailJobFree(event->job);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void QueueThumbnailEvent(ThumbnailJob *job)
+{
+    PackageData *packagePtr = job->request->package;
+    ThumbnailEvent *event = (ThumbnailEvent *)Tcl_Alloc(sizeof(ThumbnailEvent));
+    event->event.proc = ThumbnailEventProc;
+    event->job = job;
+    Tcl_ThreadQueueEvent(packagePtr->threadId, (Tcl_Event *)event, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(packagePtr->threadId);
+}
+
+// Thread pool worker. Runs outside the Tcl thread so must not touch any
+// Tcl objects owned by the request.
+static void ThumbnailWorker(gpointer data, gpointer userData)
+{
+    ThumbnailJob *job = (ThumbnailJob *)data;
+    ThumbnailRequest *request = job->request;
+    if (!g_atomic_int_get(&request->package->shutdown)) {
+        job->pixels = DecodeThumbnail(request->uri, job->index, request->count,
+                                      request->width, request->height);
+    }
+    QueueThumbnailEvent(job);
+}
+
+// Local files are cached against their modification time so that a file
+// changed on disk is decoded again.
+static gint64 ThumbnailSourceTime(const gchar *uri)
+{
+    gint64 mtime = 0;
+    gchar *filename = g_filename_from_uri(uri, NULL, NULL);
+    if (filename) {
+        GStatBuf st;
+        if (g_stat(filename, &st) == 0) {
+            mtime = (gint64)st.st_mtime;
+        }
+        g_free(filename);
+    }
+    return mtime;
+}
+
+static int GstThumbnailsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    enum {OPT_COUNT, OPT_SIZE, OPT_COMMAND};
+    static const char *opts[] = {
+        "-count", "-size", "-command", NULL
+    };
+    PackageData *packagePtr = (PackageData *)clientData;
+    int count = DEF_THUMBNAIL_COUNT, width = DEF_THUMBNAIL_WIDTH, height = DEF_THUMBNAIL_HEIGHT;
+    Tcl_Obj *commandObj = NULL;
+
+    if (objc < 3 || (objc & 1) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "uri ?-count n? ?-size WxH? -command cmd");
+        return TCL_ERROR;
+    }
+
+    for (int optindex = 3; optindex < objc; optindex += 2) {
+        int index = 0;
+        if (Tcl_GetIndexFromObj(interp, objv[optindex], opts, "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_COUNT:
+                if (Tcl_GetIntFromObj(interp, objv[optindex + 1], &count) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                if (count < 1) {
+                    Tcl_SetObjResult(interp, Tcl_NewStringObj("count must be a positive integer", -1));
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_SIZE:
+                if (sscanf(Tcl_GetString(objv[optindex + 1]), "%dx%d", &width, &height) != 2
+                    || width < 1 || height < 1) {
+                    Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid size \"%s\": must be WxH",
+                        Tcl_GetString(objv[optindex + 1])));
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_COMMAND:
+                commandObj = objv[optindex + 1];
+                break;
+        }
+    }
+    if (commandObj == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("the -command option is required", -1));
+        return TCL_ERROR;
+    }
+
+    // Accept plain filenames as well as uris.
+    const char *location = Tcl_GetString(objv[2]);
+    gchar *uri = NULL;
+    if (gst_uri_is_valid(location)) {
+        uri = g_strdup(location);
+    } else {
+        GError *err = NULL;
+        uri = gst_filename_to_uri(location, &err);
+        if (uri == NULL) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid uri \"%s\": %s", location, err->message));
+            g_error_free(err);
+            return TCL_ERROR;
+        }
+    }
+
+    if (InitPackage(interp, packagePtr) != TCL_OK) {
+        g_free(uri);
+        return TCL_ERROR;
+    }
+
+    if (packagePtr->thumbnailPool == NULL) {
+        GError *err = NULL;
+        packagePtr->thumbnailPool = g_thread_pool_new(ThumbnailWorker, packagePtr,
+            (gint)g_get_num_processors(), FALSE, &err);
+        if (packagePtr->thumbnailPool == NULL) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create thumbnail workers: %s", err->message));
+            g_error_free(err);
+            g_free(uri);
+            return TCL_ERROR;
+        }
+        packagePtr->thumbnailCache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    ThumbnailRequest *request = (ThumbnailRequest *)Tcl_Alloc(sizeof(ThumbnailRequest));
+    memset(request, 0, sizeof(ThumbnailRequest));
+    request->package = packagePtr;
+    request->interp = interp;
+    Tcl_Preserve(interp);
+    request->uriObj = Tcl_NewStringObj(uri, -1);
+    Tcl_IncrRefCount(request->uriObj);
+    request->commandObj = commandObj;
+    Tcl_IncrRefCount(request->commandObj);
+    request->uri = uri;
+    request->cacheKey = g_strdup_printf("%s@%" G_GINT64_FORMAT ":%dx%d/%d",
+        uri, ThumbnailSourceTime(uri), width, height, count);
+    request->count = count;
+    request->width = width;
+    request->height = height;
+    request->refCount = count;
+
+    for (int index = 0; index < count; ++index) {
+        ThumbnailJob *job = (ThumbnailJob *)Tcl_Alloc(sizeof(ThumbnailJob));
+        memset(job, 0, sizeof(ThumbnailJob));
+        job->request = request;
+        job->index = index;
+        gchar *key = ThumbnailCacheKey(job);
+        guchar *pixels = (guchar *)g_hash_table_lookup(packagePtr->thumbnailCache, key);
+        g_free(key);
+        if (pixels != NULL) {
+            job->cached = TRUE;
+            job->pixels = g_memdup2(pixels, (gsize)width * height * 4);
+            QueueThumbnailEvent(job);
+        } else {
+            g_thread_pool_push(packagePtr->thumbnailPool, job, NULL);
+        }
+    }
+    return TCL_OK;
+}
+
+static int InvokeEnsemble(struct Ensemble *ensemble, ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
 {
-    struct Ensemble *ensemble = WidgetEnsemble;
     int optPtr = 1;
     int index;
 
@@ -493,6 +1933,11 @@ static int GstWidgetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc,
     return TCL_ERROR;
 }
 
+static int GstWidgetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    return InvokeEnsemble(WidgetEnsemble, clientData, interp, objc, objv);
+}
+
 static int GstObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
 {
     PackageData *packagePtr = (PackageData *)clientData;
@@ -502,6 +1947,15 @@ static int GstObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
         return TCL_ERROR;
     }
 
+    // Anything that is not a window path is a package subcommand.
+    if (Tcl_GetString(objv[1])[0] != '.') {
+        return InvokeEnsemble(PackageEnsemble, clientData, interp, objc, objv);
+    }
+
+    if (InitPackage(interp, packagePtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
     Tk_Window tkwin = Tk_CreateWindowFromPath(interp, Tk_MainWindow(interp),
         Tcl_GetStringFromObj(objv[1], NULL), (char *)NULL);
     if (tkwin == NULL) {
@@ -525,11 +1979,13 @@ static int GstObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
         return TCL_ERROR;
     }
 
+    // Widgets may outlive the gst command when an interpreter is deleted.
+    Tcl_Preserve(clientData);
     Tk_CreateEventHandler(tkwin, ExposureMask | StructureNotifyMask, GstWidgetEventProc, (ClientData)dataPtr);
 
     if (Configure(interp, dataPtr, objc - 2, objv + 2) != TCL_OK) {
+        // The DestroyNotify handler releases dataPtr.
         Tk_DestroyWindow(tkwin);
-        Tcl_Free((char *)dataPtr);
         return TCL_ERROR;
     }
 
@@ -538,175 +1994,392 @@ static int GstObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
 }
 /*
  * Free the package data structure.
+ * Any thumbnail workers are stopped and their undelivered results dropped.
  * All the GStreamer bus items need to be released and the device monitor
  * stopped and unreferenced.
- * Also deinitialize the GStreamer library itself.
+ * GStreamer itself is left initialized as it is process wide and may be in
+ * use elsewhere; see GstExitHandler. The memory is kept until any remaining
+ * widgets have been destroyed.
  */
 static void GstPkgCleanup(void *clientData)
 {
     PackageData *packagePtr = (PackageData *)clientData;
-    gst_device_monitor_stop(packagePtr->monitor);
-    gst_object_unref(packagePtr->monitor);
-    for (GList *bus = packagePtr->busses; bus != NULL; bus = bus->next) {
+    if (packagePtr->thumbnailPool != NULL) {
+        // Let queued jobs drain without decoding, then drop their events.
+        g_atomic_int_set(&packagePtr->shutdown, 1);
+        g_thread_pool_free(packagePtr->thumbnailPool, FALSE, TRUE);
+        Tcl_DeleteEvents(ThumbnailEventDeleteProc, (ClientData)packagePtr);
+        g_hash_table_destroy(packagePtr->thumbnailCache);
+    }
+    if (packagePtr->monitorThread != NULL) {
+        g_thread_join(packagePtr->monitorThread);
+    }
+    if (packagePtr->monitor != NULL) {
+        if (packagePtr->monitorState == MONITOR_STARTED) {
+            gst_device_monitor_stop(packagePtr->monitor);
+        }
+        GstBus *bus = gst_device_monitor_get_bus(packagePtr->monitor);
+        UnrouteBus(packagePtr->tsdPtr, bus);
         gst_object_unref(bus);
+        gst_object_unref(packagePtr->monitor);
+        packagePtr->monitor = NULL;
+    }
+    if (packagePtr->initialized) {
+        ReleaseThreadData(packagePtr->tsdPtr);
+        ReleaseGstreamer();
+        packagePtr->initialized = 0;
     }
-    g_list_free(packagePtr->busses);
-    g_list_free(packagePtr->devices);
-    gst_deinit();
-    Tcl_Free((char *)packagePtr);
+    Tcl_EventuallyFree(clientData, FreePackage);
 }
 
-// Handle GStreamer message bus events.
-static int EventProc(Tcl_Event *evPtr, int flags)
+static void FreePackage(char *memPtr)
 {
-    GstTclEvent *event = (GstTclEvent *)evPtr;
-    GstMessage *message = NULL;
-    if (!(flags & TCL_WINDOW_EVENTS)) {
-        return 0;
-    }
-    while ((message = gst_bus_pop(GST_BUS(event->bus))) != NULL) {
-        switch (GST_MESSAGE_TYPE(message))
-        {
-            case GST_MESSAGE_DEVICE_ADDED:
-                {
-                    GstDevice *device;
-                    gst_message_parse_device_added(message, &device);
-                    gchar *name = gst_device_get_display_name(device);
-                    g_message("device add \"%s\"", name);
-                    g_free(name);
-                    gst_object_unref(device);
-                }
-                break;
-            case GST_MESSAGE_DEVICE_REMOVED:
-                {
-                    GstDevice *device;
-                    gst_message_parse_device_removed(message, &device);
-                    gchar *name = gst_device_get_display_name(device);
-                    g_message("device removed \"%s\"", name);
-                    g_free(name);
-                    gst_object_unref(device);
-                }
-                break;
-            case GST_MESSAGE_DEVICE_CHANGED:
-                {
-                    GstDevice *device;
-                    gst_message_parse_device_changed(message, &device, NULL);
-                    gchar *name = gst_device_get_display_name(device);
-                    g_message("device change \"%s\"", name);
-                    g_free(name);
-                    gst_object_unref (device);
-                }
-                break;
-            case GST_MESSAGE_ELEMENT:
+    PackageData *packagePtr = (PackageData *)memPtr;
+    g_mutex_clear(&packagePtr->monitorLock);
+    g_cond_clear(&packagePtr->monitorCond);
+    Tcl_Free(memPtr);
+}
+
+// Handle a GStreamer bus message on the thread that owns the bus.
+static void HandleBusMessage(GstBus *bus, GstMessage *message)
+{
+    switch (GST_MESSAGE_TYPE(message))
+    {
+        case GST_MESSAGE_DEVICE_ADDED:
+            if (LOG_ENABLED(LOG_CAT_DEVICE, LOG_INFO)) {
+                GstDevice *device;
+                gst_message_parse_device_added(message, &device);
+                gchar *name = gst_device_get_display_name(device);
+                TKGST_LOG(LOG_CAT_DEVICE, LOG_INFO, "device add \"%s\"", name);
+                g_free(name);
+                gst_object_unref(device);
+            }
+            break;
+        case GST_MESSAGE_DEVICE_REMOVED:
+            if (LOG_ENABLED(LOG_CAT_DEVICE, LOG_INFO)) {
+                GstDevice *device;
+                gst_message_parse_device_removed(message, &device);
+                gchar *name = gst_device_get_display_name(device);
+                TKGST_LOG(LOG_CAT_DEVICE, LOG_INFO, "device removed \"%s\"", name);
+                g_free(name);
+                gst_object_unref(device);
+            }
+            break;
+        case GST_MESSAGE_DEVICE_CHANGED:
+            if (LOG_ENABLED(LOG_CAT_DEVICE, LOG_INFO)) {
+                GstDevice *device;
+                gst_message_parse_device_changed(message, &device, NULL);
+                gchar *name = gst_device_get_display_name(device);
+                TKGST_LOG(LOG_CAT_DEVICE, LOG_INFO, "device change \"%s\"", name);
+                g_free(name);
+                gst_object_unref(device);
+            }
+            break;
+        case GST_MESSAGE_ELEMENT:
+            {
+                const GstStructure *s = gst_message_get_structure(message);
+                GstNavigationMessageType mt = gst_navigation_message_get_type(message);
+                if (mt == GST_NAVIGATION_MESSAGE_EVENT)
                 {
-                    const GstStructure *s = gst_message_get_structure(message);
-                    GstNavigationMessageType mt = gst_navigation_message_get_type(message);
-                    if (mt == GST_NAVIGATION_MESSAGE_EVENT)
+                    GstEvent *ge;
+                    if (LOG_ENABLED(LOG_CAT_NAVIGATION, LOG_DEBUG)
+                        && gst_navigation_message_parse_event(message, &ge))
                     {
-                        GstEvent *ge;
-                        if (gst_navigation_message_parse_event(message, &ge))
+                        gboolean br = False, button_press = False;
+                        gint button = 0;
+                        gdouble x = 0, y = 0;
+                        const gchar *keys = NULL;
+
+                        switch (gst_navigation_event_get_type(ge))
                         {
-                            gboolean br = False, button_press = False;
-                            gint button = 0;
-                            gdouble x = 0, y = 0;
-                            const gchar *keys = NULL;
-
-                            switch (gst_navigation_event_get_type(ge))
-                            {
-                                case GST_NAVIGATION_EVENT_MOUSE_MOVE:
-                                    br = gst_navigation_event_parse_mouse_move_event(ge, &x, &y);
-                                    if (br)
-                                        g_message("mouse move @%.1f,%.1f", x, y);
-                                    break;
-                                case GST_NAVIGATION_EVENT_MOUSE_BUTTON_PRESS:
-                                    button_press = True;
-                                    /* FALL THROUGH */
-                                case GST_NAVIGATION_EVENT_MOUSE_BUTTON_RELEASE:
-                                    br = gst_navigation_event_parse_mouse_button_event(ge, &button, &x, &y);
-                                    if (br)
-                                        g_message("mouse event @%.1f,%.1f %d %s", x, y, button, button_press ? "press" : "release");
-                                    break;
-                                case GST_NAVIGATION_EVENT_KEY_PRESS:
-                                case GST_NAVIGATION_EVENT_KEY_RELEASE:
-                                    br = gst_navigation_event_parse_key_event(ge, &keys);
-                                    if (br)
-                                        g_message("key event %s", keys);
-                                    break;
-                            }
-                            gst_event_unref(ge);
+                            case GST_NAVIGATION_EVENT_MOUSE_MOVE:
+                                br = gst_navigation_event_parse_mouse_move_event(ge, &x, &y);
+                                if (br)
+                                    TKGST_LOG(LOG_CAT_NAVIGATION, LOG_TRACE, "mouse move @%.1f,%.1f", x, y);
+                                break;
+                            case GST_NAVIGATION_EVENT_MOUSE_BUTTON_PRESS:
+                                button_press = True;
+                                /* FALL THROUGH */
+                            case GST_NAVIGATION_EVENT_MOUSE_BUTTON_RELEASE:
+                                br = gst_navigation_event_parse_mouse_button_event(ge, &button, &x, &y);
+                                if (br)
+                                    TKGST_LOG(LOG_CAT_NAVIGATION, LOG_DEBUG, "mouse event @%.1f,%.1f %d %s", x, y, button, button_press ? "press" : "release");
+                                break;
+                            case GST_NAVIGATION_EVENT_KEY_PRESS:
+                            case GST_NAVIGATION_EVENT_KEY_RELEASE:
+                                br = gst_navigation_event_parse_key_event(ge, &keys);
+                                if (br)
+                                    TKGST_LOG(LOG_CAT_NAVIGATION, LOG_DEBUG, "key event %s", keys);
+                                break;
                         }
-                    }
-                    else {
-                        g_message("\"%s\"", gst_structure_get_name(s));
+                        gst_event_unref(ge);
                     }
                 }
-                break;
-            case GST_MESSAGE_STATE_CHANGED:
-                {
-                    GstState oldstate, newstate, pending;
-                    gst_message_parse_state_changed(message, &oldstate, &newstate, &pending);
-                    g_message("gst state-changed %d -> %d pending %d", oldstate, newstate, pending);
+                else {
+                    TKGST_LOG(LOG_CAT_BUS, LOG_DEBUG, "\"%s\"", gst_structure_get_name(s));
                 }
-                break;
-            case GST_MESSAGE_ERROR:
-                {
-                    GError *err = NULL;
-                    gchar *debugInfo = NULL;
-                    gst_message_parse_error(message, &err, &debugInfo);
-                    g_message("error from '%s': %s", GST_OBJECT_NAME(message->src), err->message);
-                    if (debugInfo) {
-                        g_message("%s", debugInfo);
-                    }
-                    g_error_free(err);
-                    g_free(debugInfo);
+            }
+            break;
+        case GST_MESSAGE_STATE_CHANGED:
+            {
+                GstState oldstate, newstate, pending;
+                gst_message_parse_state_changed(message, &oldstate, &newstate, &pending);
+                TKGST_LOG(LOG_CAT_BUS, LOG_DEBUG, "gst state-changed '%s' %s -> %s pending %s",
+                    GST_OBJECT_NAME(message->src), gst_element_state_get_name(oldstate),
+                    gst_element_state_get_name(newstate), gst_element_state_get_name(pending));
+            }
+            break;
+        case GST_MESSAGE_ERROR:
+            {
+                GError *err = NULL;
+                gchar *debugInfo = NULL;
+                gst_message_parse_error(message, &err, &debugInfo);
+                TKGST_LOG(LOG_CAT_BUS, LOG_ERROR, "error from '%s': %s", GST_OBJECT_NAME(message->src), err->message);
+                if (debugInfo) {
+                    TKGST_LOG(LOG_CAT_BUS, LOG_DEBUG, "%s", debugInfo);
                 }
-                break;
-            case GST_MESSAGE_EOS:
-            case GST_MESSAGE_WARNING:
-                //Tcl_QueueEvent(TkGstErrEvent, TCL_QUEUE_TAIL);
-                //break;
-            default:
-                g_message("gst message \"%s\"", gst_message_type_get_name(GST_MESSAGE_TYPE(message)));
+                g_error_free(err);
+                g_free(debugInfo);
+                WidgetData *dataPtr = (WidgetData *)g_object_get_data(G_OBJECT(bus), "tkgst-widget");
+                if (dataPtr != NULL) {
+                    HandlePipelineError(dataPtr);
+                }
+            }
+            break;
+        case GST_MESSAGE_EOS:
+        case GST_MESSAGE_WARNING:
+            //Tcl_QueueEvent(TkGstErrEvent, TCL_QUEUE_TAIL);
+            //break;
+        default:
+            TKGST_LOG(LOG_CAT_BUS, LOG_TRACE, "gst message \"%s\"", gst_message_type_get_name(GST_MESSAGE_TYPE(message)));
+    }
+}
+
+// Handle GStreamer message bus events queued for this thread.
+static int EventProc(Tcl_Event *evPtr, int flags)
+{
+    GstTclEvent *event = (GstTclEvent *)evPtr;
+    ThreadSpecificData *tsdPtr = event->tsdPtr;
+    BusMessage *item = NULL;
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+        return 0;
+    }
+    tsdPtr->eventPending = 0;
+    ++tsdPtr->wakeups;
+    while ((item = (BusMessage *)g_async_queue_try_pop(tsdPtr->queue)) != NULL) {
+        ++tsdPtr->messages;
+        // The owner is set from the interpreter that created the bus, not
+        // from the route, so a misrouted message shows up here.
+        Tcl_ThreadId owner = (Tcl_ThreadId)g_object_get_data(G_OBJECT(item->bus), "tkgst-owner");
+        if (owner != NULL && owner != Tcl_GetCurrentThread()) {
+            ++tsdPtr->foreign;
         }
-        gst_message_unref(message);
+        HandleBusMessage(item->bus, item->message);
+        FreeBusMessage(item);
     }
     return 1;
 }
 
-// Called at intervals determined by SetupProc to check the gst bus
-// for messages and if any schedule a Tcl event to get them processed.
+// Report how often bus messages woke the calling thread. Used to confirm
+// that no thread handles messages routed to another.
+static int GstEventStatsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[])
+{
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "eventstats");
+        return TCL_ERROR;
+    }
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+    Tcl_Obj *resultObj = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("wakeups", -1), Tcl_NewWideIntObj(tsdPtr->wakeups));
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("messages", -1), Tcl_NewWideIntObj(tsdPtr->messages));
+    Tcl_DictObjPut(interp, resultObj, Tcl_NewStringObj("foreign", -1), Tcl_NewWideIntObj(tsdPtr->foreign));
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+static int EventDeleteProc(Tcl_Event *evPtr, ClientData clientData)
+{
+    return evPtr->proc == EventProc && ((GstTclEvent *)evPtr)->tsdPtr == (ThreadSpecificData *)clientData;
+}
+
+// Queue a Tcl event to handle any bus messages routed to this thread.
 static void CheckProc(ClientData clientData, int flags)
 {
-    PackageData *packagePtr = (PackageData *)clientData;
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)clientData;
     if (!(flags & TCL_WINDOW_EVENTS)) {
         return;
     }
-    for (GList *node = packagePtr->busses; node != NULL; node = node->next) {
-        if (gst_bus_have_pending(GST_BUS(node->data))) {
-            GstTclEvent *event = (GstTclEvent *)Tcl_Alloc(sizeof(GstTclEvent));
-            event->event.proc = EventProc;
-            event->bus = GST_BUS(node->data);
-            Tcl_QueueEvent((Tcl_Event *)event, TCL_QUEUE_TAIL);
-        }
+    if (!tsdPtr->eventPending && g_async_queue_length(tsdPtr->queue) > 0) {
+        GstTclEvent *event = (GstTclEvent *)Tcl_Alloc(sizeof(GstTclEvent));
+        event->event.proc = EventProc;
+        event->tsdPtr = tsdPtr;
+        tsdPtr->eventPending = 1;
+        Tcl_QueueEvent((Tcl_Event *)event, TCL_QUEUE_TAIL);
     }
 }
 
-// Check the gst bus for pending events and set the block interval
-// to either immediate or 10ms for calling CheckProp
+// Don't block if messages arrived since the last check. Otherwise the
+// sync handler alerts the notifier so no polling interval is needed.
 static void SetupProc(ClientData clientData, int flags)
 {
-    PackageData *packagePtr = (PackageData *)clientData;
-    Tcl_Time block_time = {0, 10000};
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)clientData;
+    Tcl_Time block_time = {0, 0};
     if (!(flags & TCL_WINDOW_EVENTS)) {
         return;
     }
-    for (GList *node = packagePtr->busses; node != NULL; node = node->next) {
-        if (gst_bus_have_pending(GST_BUS(node->data))) {
-            block_time.usec = 0;
-            break;
+    if (g_async_queue_length(tsdPtr->queue) > 0) {
+        Tcl_SetMaxBlockTime(&block_time);
+    }
+}
+
+// Set up the thread's message queue and event source for the first
+// package initialized in this thread.
+static ThreadSpecificData *AcquireThreadData(void)
+{
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+    if (tsdPtr->refCount++ == 0) {
+        tsdPtr->queue = g_async_queue_new_full(FreeBusMessage);
+        Tcl_CreateEventSource(SetupProc, CheckProc, (ClientData)tsdPtr);
+    }
+    return tsdPtr;
+}
+
+static void ReleaseThreadData(ThreadSpecificData *tsdPtr)
+{
+    if (--tsdPtr->refCount > 0) {
+        return;
+    }
+    Tcl_DeleteEventSource(SetupProc, CheckProc, (ClientData)tsdPtr);
+    Tcl_DeleteEvents(EventDeleteProc, (ClientData)tsdPtr);
+    if (tsdPtr->levelTimer != NULL) {
+        Tcl_DeleteTimerHandler(tsdPtr->levelTimer);
+        tsdPtr->levelTimer = NULL;
+    }
+    g_list_free(tsdPtr->meters);
+    tsdPtr->meters = NULL;
+    tsdPtr->eventPending = 0;
+    while (tsdPtr->busses != NULL) {
+        UnrouteBus(tsdPtr, GST_BUS(tsdPtr->busses->data));
+    }
+    // Undelivered messages are freed with the last reference to the queue.
+    g_async_queue_unref(tsdPtr->queue);
+    tsdPtr->queue = NULL;
+}
+
+/*
+ * GStreamer is initialized by the first interpreter, in any thread, that
+ * needs it and each initialized package holds a reference. If it was
+ * already initialized by the application or another extension then it is
+ * left to them to shut it down. Otherwise it is deinitialized at process
+ * exit provided no interpreter still holds a reference, after any extension
+ * loaded later has run its own exit handler. It is never deinitialized
+ * earlier as GStreamer cannot be initialized a second time.
+ */
+static GMutex gstInitLock;
+static int gstInitCount = 0;
+static int gstInitOwned = 0;
+
+static void GstExitHandler(ClientData clientData)
+{
+    g_mutex_lock(&gstInitLock);
+    if (gstInitOwned && gstInitCount == 0) {
+        gst_deinit();
+        gstInitOwned = 0;
+    }
+    g_mutex_unlock(&gstInitLock);
+}
+
+static int InitGstreamer(Tcl_Interp *interp)
+{
+    GError *err = NULL;
+    int r = TCL_OK;
+    g_mutex_lock(&gstInitLock);
+    if (!gst_is_initialized()) {
+        if (gst_init_check(NULL, NULL, &err)) {
+            gstInitOwned = 1;
+            Tcl_CreateExitHandler(GstExitHandler, NULL);
+        } else {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to initialize gstreamer: %s",
+                err ? err->message : "unknown error"));
+            if (err)
+                g_error_free(err);
+            r = TCL_ERROR;
         }
     }
-    Tcl_SetMaxBlockTime(&block_time);
+    if (r == TCL_OK) {
+        ++gstInitCount;
+    }
+    g_mutex_unlock(&gstInitLock);
+    return r;
+}
+
+static void ReleaseGstreamer(void)
+{
+    g_mutex_lock(&gstInitLock);
+    --gstInitCount;
+    g_mutex_unlock(&gstInitLock);
+}
+
+// Deferred package initialization, run by the first command that needs
+// GStreamer rather than by package require.
+static int InitPackage(Tcl_Interp *interp, PackageData *packagePtr)
+{
+    if (packagePtr->initialized) {
+        return TCL_OK;
+    }
+    if (InitGstreamer(interp) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    GST_DEBUG_CATEGORY_INIT(tkgst_debug, "tkgst", 0, "Tk GStreamer widget");
+    // NOTE: each pipeline has one bus. The thread's event source handles the
+    //       messages of all the busses routed to it, as we have one pipeline
+    //       per widget therefore each video widget has its own bus.
+    packagePtr->tsdPtr = AcquireThreadData();
+    packagePtr->initialized = 1;
+    return TCL_OK;
+}
+
+// Starting the monitor probes every device provider which can be slow so
+// it is done on a separate thread.
+static gpointer DeviceMonitorThread(gpointer data)
+{
+    PackageData *packagePtr = (PackageData *)data;
+    gboolean started = gst_device_monitor_start(packagePtr->monitor);
+    g_mutex_lock(&packagePtr->monitorLock);
+    packagePtr->monitorState = started ? MONITOR_STARTED : MONITOR_FAILED;
+    g_cond_broadcast(&packagePtr->monitorCond);
+    g_mutex_unlock(&packagePtr->monitorLock);
+    return NULL;
+}
+
+// Create and start the device monitor if this has not already been done.
+// If wait is set then block until the initial device probe has completed.
+static int StartDeviceMonitor(Tcl_Interp *interp, PackageData *packagePtr, int wait)
+{
+    if (InitPackage(interp, packagePtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (packagePtr->monitor == NULL) {
+        packagePtr->monitor = gst_device_monitor_new();
+        GstBus *bus = gst_device_monitor_get_bus(packagePtr->monitor);
+        g_object_set_data(G_OBJECT(bus), "tkgst-owner", (gpointer)packagePtr->threadId);
+        RouteBus(packagePtr->tsdPtr, bus);
+        packagePtr->monitorState = MONITOR_STARTING;
+        packagePtr->monitorThread = g_thread_new("tkgst-monitor", DeviceMonitorThread, packagePtr);
+    }
+
+    g_mutex_lock(&packagePtr->monitorLock);
+    while (wait && packagePtr->monitorState == MONITOR_STARTING) {
+        g_cond_wait(&packagePtr->monitorCond, &packagePtr->monitorLock);
+    }
+    int state = packagePtr->monitorState;
+    g_mutex_unlock(&packagePtr->monitorLock);
+
+    if (state == MONITOR_FAILED) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("failed to start the device monitor", -1));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
 }
 
 int Tkgst_Init(Tcl_Interp *interp)
@@ -717,23 +2390,14 @@ int Tkgst_Init(Tcl_Interp *interp)
     if (Tk_InitStubs(interp, TK_VERSION, 0) == NULL)
         return TCL_ERROR;
     if (r == TCL_OK) {
-
-        gst_init(NULL, NULL);
-
-        // NOTE: each pipeline has one bus. The event source will need to be a list of bus objects,
-        //       as we should have one pipeline per widget therefore each video widget will have its
-        //       own bus.
+        // GStreamer, the event source and the device monitor are all set up
+        // on first use so that loading the package is cheap.
         PackageData *packagePtr = (PackageData *)Tcl_Alloc(sizeof(PackageData));
         memset(packagePtr, 0, sizeof(PackageData));
+        packagePtr->threadId = Tcl_GetCurrentThread();
+        g_mutex_init(&packagePtr->monitorLock);
+        g_cond_init(&packagePtr->monitorCond);
 
-        // start a device monitor for use with the widget "devices" command.
-        packagePtr->monitor = gst_device_monitor_new();
-        gst_device_monitor_start(packagePtr->monitor);
-        packagePtr->devices = gst_device_monitor_get_devices(packagePtr->monitor); // FIX ME: maybe not needed
-
-        packagePtr->busses = g_list_append(packagePtr->busses, gst_device_monitor_get_bus(packagePtr->monitor));
-
-        Tcl_CreateEventSource(SetupProc, CheckProc, (ClientData)packagePtr);
         Tcl_CreateObjCommand(interp, "gst", GstObjCmd, (ClientData)packagePtr, GstPkgCleanup);
         r = Tcl_PkgProvide(interp, PACKAGE_NAME, PACKAGE_VERSION);
     }
@@ -6,6 +6,8 @@
 #define REDRAW_PENDING   0x01
 #define UPDATE_V_SCROLL  0x02
 #define UPDATE_H_SCROLL  0x04
+#define RESTART_PENDING  0x08
+#define IO_MODE_FALLBACK 0x10
 
 typedef struct {
                            /* widget core */
@@ -24,10 +26,20 @@ typedef struct {
     Tk_Anchor anchor;
     Tcl_Obj  *bgPtr;
     Tcl_Obj  *devicePtr;
+    Tcl_Obj  *buffersPtr;
+    int       buffers;     /* buffers per pool, 0 for negotiated */
+    Tcl_Obj  *ioModePtr;
+    int       ioMode;      /* index into the io-mode table */
+    Tcl_Obj  *sharePoolPtr;
+    int       sharePool;
+    Tcl_Obj  *audioDevicePtr;
+    Tcl_Obj  *levelCommandPtr;
 
     ClientData packageData;
     ClientData platformData;
     ClientData channelMap;
+    ClientData allocStats;
+    ClientData levelMeter;
 
 } WidgetData;
 